@@ -0,0 +1,257 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+#include "spsc_ring.h"
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+// Decorator which moves packet consumption off the receiving thread. Packets are copied into a
+// bounded SpscRing and a consumer thread owned by AsyncCallback hands them to the wrapped callback,
+// so Receive doesn't wait for a slow consumer until the ring is full. Then the receiving thread
+// either waits for room (Block) or drops the packet (Drop); both are counted. Packets too big for a
+// record of the ring go in several and are delivered whole. Only whole packets are dropped: the
+// pieces of streamed packets and frame errors always wait for room, so the wrapped callback never
+// sees a stream with pieces missing. Must be fed by one thread at a time,
+// like a Receiver. The destructor delivers what is queued before returning.
+struct AsyncCallback : public ICallback {
+    enum class Overflow {
+        Block,
+        Drop,
+    };
+
+    AsyncCallback(std::shared_ptr<ICallback> callback_, std::size_t capacity, Overflow overflow_ = Overflow::Block)
+            : callback(std::move(callback_)),
+              ring(capacity),
+              overflow(overflow_),
+              consumer([this] { consume(); }) {
+    }
+
+    ~AsyncCallback() override {
+        while (!push(STOP_RECORD, nullptr, 0)) {
+            ring.waitForRoom();
+        }
+        consumer.join();
+    }
+
+    AsyncCallback(const AsyncCallback &callback) = delete;
+
+    AsyncCallback &operator=(const AsyncCallback &callback) = delete;
+
+    void BinaryPacket(const Byte *data, std::size_t size) override {
+        enqueue(PacketType::Binary, data, size);
+    }
+
+    void TextPacket(const Byte *data, std::size_t size) override {
+        enqueue(PacketType::Text, data, size);
+    }
+
+    void Packets(std::span<const PacketView> packets) override {
+        for (const auto &packet: packets) {
+            enqueue(packet.type, packet.data, packet.size);
+        }
+    }
+
+    // queued like a packet, so the wrapped callback hears about it in the same order
+    void InvalidFrame(FrameError error) override {
+        const auto code = static_cast<Byte>(error);
+        enqueue(INVALID_FRAME_RECORD, &code, sizeof(code), Overflow::Block);
+    }
+
+    void BinaryBegin(std::size_t size) override {
+        const auto payloadSize = static_cast<std::uint64_t>(size);
+        enqueue(BINARY_BEGIN_RECORD, reinterpret_cast<const Byte *>(&payloadSize), sizeof(payloadSize),
+                Overflow::Block);
+    }
+
+    void BinaryChunk(const Byte *data, std::size_t size) override {
+        enqueueChunk(BINARY_CHUNK_RECORD, data, size);
+    }
+
+    void BinaryEnd() override {
+        enqueue(BINARY_END_RECORD, nullptr, 0, Overflow::Block);
+    }
+
+    void TextBegin() override {
+        enqueue(TEXT_BEGIN_RECORD, nullptr, 0, Overflow::Block);
+    }
+
+    void TextChunk(const Byte *data, std::size_t size) override {
+        enqueueChunk(TEXT_CHUNK_RECORD, data, size);
+    }
+
+    void TextEnd() override {
+        enqueue(TEXT_END_RECORD, nullptr, 0, Overflow::Block);
+    }
+
+    // packets lost to a full ring (Drop)
+    [[nodiscard]] std::size_t droppedPackets() const noexcept {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    // times the receiving thread had to wait for the consumer (Block, or for a stream's pieces)
+    [[nodiscard]] std::size_t stalls() const noexcept {
+        return stalled.load(std::memory_order_relaxed);
+    }
+
+    // bytes queued for the consumer
+    [[nodiscard]] std::size_t pendingBytes() const noexcept {
+        return ring.usedBytes();
+    }
+
+private:
+    // first byte of a record, after the PacketType values
+    static constexpr Byte BINARY_BEGIN_RECORD = 0x10;
+    static constexpr Byte BINARY_CHUNK_RECORD = 0x11;
+    static constexpr Byte BINARY_END_RECORD = 0x12;
+    static constexpr Byte TEXT_BEGIN_RECORD = 0x20;
+    static constexpr Byte TEXT_CHUNK_RECORD = 0x21;
+    static constexpr Byte TEXT_END_RECORD = 0x22;
+    // pieces of a packet bigger than a record, the last piece goes as the packet's record
+    static constexpr Byte BINARY_PART_RECORD = 0x13;
+    static constexpr Byte TEXT_PART_RECORD = 0x23;
+    static constexpr Byte INVALID_FRAME_RECORD = 0x30;
+    static constexpr Byte STOP_RECORD = 0xFF;
+
+    void enqueue(PacketType type, const Byte *data, std::size_t size) {
+        const auto maxPart = ring.maxRecordSize() - 1;
+        const auto kind = static_cast<Byte>(type);
+        if (size <= maxPart) {
+            enqueue(kind, data, size, overflow);
+            return;
+        }
+        // Once the first part is queued the others wait for room even with Drop, so a packet is
+        // lost whole or not at all.
+        const auto partKind = type == PacketType::Binary ? BINARY_PART_RECORD : TEXT_PART_RECORD;
+        if (!enqueue(partKind, data, maxPart, overflow)) {
+            return;
+        }
+        for (data += maxPart, size -= maxPart; size > maxPart; data += maxPart, size -= maxPart) {
+            enqueue(partKind, data, maxPart, Overflow::Block);
+        }
+        enqueue(kind, data, size, Overflow::Block);
+    }
+
+    // False if the record was dropped.
+    bool enqueue(Byte kind, const Byte *data, std::size_t size, Overflow mode) {
+        assert(size + 1 <= ring.maxRecordSize());
+        while (!push(kind, data, size)) {
+            if (mode == Overflow::Drop) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            stalled.fetch_add(1, std::memory_order_relaxed);
+            ring.waitForRoom();
+        }
+        return true;
+    }
+
+    // the wrapped callback gets the chunk in pieces if it doesn't fit in a record
+    void enqueueChunk(Byte kind, const Byte *data, std::size_t size) {
+        const auto maxChunk = ring.maxRecordSize() - 1;
+        do {
+            const auto count = std::min(size, maxChunk);
+            enqueue(kind, data, count, Overflow::Block);
+            data += count;
+            size -= count;
+        } while (size > 0);
+    }
+
+    bool push(Byte kind, const Byte *data, std::size_t size) noexcept {
+        auto *ptr = ring.tryReserve(size + 1);
+        if (ptr == nullptr) {
+            return false;
+        }
+        ptr[0] = kind;
+        if (size > 0) {
+            std::memcpy(ptr + 1, data, size);
+        }
+        ring.commit();
+        return true;
+    }
+
+    void consume() {
+        while (true) {
+            const auto record = ring.front();
+            if (record.empty()) {
+                ring.waitForRecord();
+                continue;
+            }
+            const auto kind = record[0];
+            if (kind == STOP_RECORD) {
+                ring.pop();
+                break;
+            }
+            const auto *data = record.data() + 1;
+            const auto size = record.size() - 1;
+            switch (kind) {
+                case static_cast<Byte>(PacketType::Binary):
+                case static_cast<Byte>(PacketType::Text):
+                    deliver(static_cast<PacketType>(kind), data, size);
+                    break;
+                case BINARY_PART_RECORD:
+                case TEXT_PART_RECORD:
+                    parts.insert(parts.end(), data, data + size);
+                    break;
+                case INVALID_FRAME_RECORD:
+                    callback->InvalidFrame(static_cast<FrameError>(data[0]));
+                    break;
+                case BINARY_BEGIN_RECORD: {
+                    std::uint64_t payloadSize;
+                    std::memcpy(&payloadSize, data, sizeof(payloadSize));
+                    callback->BinaryBegin(payloadSize);
+                    break;
+                }
+                case BINARY_CHUNK_RECORD:
+                    callback->BinaryChunk(data, size);
+                    break;
+                case BINARY_END_RECORD:
+                    callback->BinaryEnd();
+                    break;
+                case TEXT_BEGIN_RECORD:
+                    callback->TextBegin();
+                    break;
+                case TEXT_CHUNK_RECORD:
+                    callback->TextChunk(data, size);
+                    break;
+                case TEXT_END_RECORD:
+                    callback->TextEnd();
+                    break;
+                default:
+                    assert(false);
+            }
+            ring.pop();
+        }
+    }
+
+    void deliver(PacketType type, const Byte *data, std::size_t size) {
+        if (!parts.empty()) {
+            parts.insert(parts.end(), data, data + size);
+            data = parts.data();
+            size = parts.size();
+        }
+        if (type == PacketType::Binary) {
+            callback->BinaryPacket(data, size);
+        } else {
+            callback->TextPacket(data, size);
+        }
+        if (!parts.empty()) {
+            // large packets are rare, their storage isn't kept
+            std::vector<Byte>().swap(parts);
+        }
+    }
+
+    std::shared_ptr<ICallback> callback;
+    SpscRing ring;
+    const Overflow overflow;
+    std::atomic<std::size_t> dropped = 0;
+    std::atomic<std::size_t> stalled = 0;
+    // consumer: the parts of a packet bigger than a record so far
+    std::vector<Byte> parts;
+    // last, it starts consuming right away
+    std::thread consumer;
+};
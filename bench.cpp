@@ -0,0 +1,239 @@
+#include "sender_receiver_bytes.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+enum class Mix {
+    Binary,
+    Text,
+    Mixed,
+};
+
+enum class Fragmentation {
+    // the whole stream in one Receive call
+    None,
+    // 75% of the stream, then the rest
+    Split75,
+    // one byte per Receive call
+    Bytes,
+    // TCP segments of an Ethernet MTU
+    Segments,
+    // pieces of 1 to 4096 bytes, uniformly
+    Random,
+};
+
+struct Stream {
+    std::vector<Byte> bytes;
+    std::size_t packets = 0;
+    // piece sizes of Fragmentation::Random, drawn once so every iteration cuts the same way
+    std::vector<std::size_t> randomCuts;
+};
+
+void appendBinary(Stream &stream, std::size_t payloadSize) {
+    stream.bytes.push_back(START_BYTE_BINARY_BLOCK);
+    const auto size = encodeBinSize(static_cast<BinSize>(payloadSize));
+    stream.bytes.insert(stream.bytes.end(), size.begin(), size.end());
+    stream.bytes.insert(stream.bytes.end(), payloadSize, Byte{0x5A});
+    ++stream.packets;
+}
+
+void appendText(Stream &stream, std::size_t textSize) {
+    stream.bytes.insert(stream.bytes.end(), textSize, Byte{'t'});
+    stream.bytes.insert(stream.bytes.end(), std::begin(ENDING_TEXT_BLOCK), std::end(ENDING_TEXT_BLOCK));
+    ++stream.packets;
+}
+
+// About 1 MB of packets (at least one) with payloads of payloadSize bytes.
+Stream makeStream(Mix mix, std::size_t payloadSize) {
+    Stream stream;
+    const std::size_t count = std::max<std::size_t>(1, (1 << 20) / payloadSize);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (mix == Mix::Binary || (mix == Mix::Mixed && i % 2 == 0)) {
+            appendBinary(stream, payloadSize);
+        } else {
+            appendText(stream, payloadSize);
+        }
+    }
+    std::minstd_rand random(1);
+    std::uniform_int_distribution<std::size_t> cut(1, 4096);
+    for (std::size_t pos = 0; pos < stream.bytes.size();) {
+        stream.randomCuts.push_back(std::min(cut(random), stream.bytes.size() - pos));
+        pos += stream.randomCuts.back();
+    }
+    return stream;
+}
+
+struct CountingHandler {
+    void Packets(std::span<const PacketView> packets) noexcept {
+        count += packets.size();
+        benchmark::DoNotOptimize(packets.data());
+    }
+
+    std::size_t count = 0;
+};
+
+struct CountingCallback : public ICallback {
+    void BinaryPacket(const Byte *data, std::size_t /*size*/) override {
+        benchmark::DoNotOptimize(data);
+        ++count;
+    }
+
+    void TextPacket(const Byte *data, std::size_t /*size*/) override {
+        benchmark::DoNotOptimize(data);
+        ++count;
+    }
+
+    std::size_t count = 0;
+};
+
+template<typename ReceiverType>
+void feed(ReceiverType &receiver, const Stream &stream, Fragmentation fragmentation) {
+    const auto *data = stream.bytes.data();
+    const auto size = stream.bytes.size();
+    switch (fragmentation) {
+        case Fragmentation::None:
+            receiver.Receive(data, size);
+            break;
+        case Fragmentation::Split75: {
+            const std::size_t part = size * 0.75;
+            receiver.Receive(data, part);
+            receiver.Receive(data + part, size - part);
+            break;
+        }
+        case Fragmentation::Bytes:
+            for (std::size_t i = 0; i < size; ++i) {
+                receiver.Receive(data + i, 1);
+            }
+            break;
+        case Fragmentation::Segments:
+            for (std::size_t i = 0; i < size; i += 1448) {
+                receiver.Receive(data + i, std::min<std::size_t>(1448, size - i));
+            }
+            break;
+        case Fragmentation::Random:
+            for (const auto count: stream.randomCuts) {
+                receiver.Receive(data, count);
+                data += count;
+            }
+            break;
+    }
+}
+
+// Time per stream byte, what perf_receive compares between runs.
+void setCounters(benchmark::State &state, const Stream &stream) {
+    state.SetItemsProcessed(state.iterations() * stream.packets);
+    state.SetBytesProcessed(state.iterations() * stream.bytes.size());
+    state.counters["time/byte"] = benchmark::Counter(
+            static_cast<double>(stream.bytes.size()),
+            benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+// Arguments: mix, payload size, fragmentation.
+void BM_Receive(benchmark::State &state) {
+    const auto stream = makeStream(static_cast<Mix>(state.range(0)), state.range(1));
+    const auto fragmentation = static_cast<Fragmentation>(state.range(2));
+    auto callback = std::make_shared<CountingCallback>();
+    Receiver receiver(callback);
+    for (auto _: state) {
+        feed(receiver, stream, fragmentation);
+    }
+    if (callback->count != stream.packets * state.iterations()) {
+        state.SkipWithError("lost packets");
+    }
+    setCounters(state, stream);
+}
+
+void BM_BasicReceive(benchmark::State &state) {
+    const auto stream = makeStream(static_cast<Mix>(state.range(0)), state.range(1));
+    const auto fragmentation = static_cast<Fragmentation>(state.range(2));
+    BasicReceiver<CountingHandler> receiver(CountingHandler{});
+    for (auto _: state) {
+        feed(receiver, stream, fragmentation);
+    }
+    if (receiver.getHandler().count != stream.packets * state.iterations()) {
+        state.SkipWithError("lost packets");
+    }
+    setCounters(state, stream);
+}
+
+void receiveArguments(benchmark::internal::Benchmark *benchmark) {
+    benchmark->ArgNames({"mix", "payload", "fragmentation"});
+    for (const auto mix: {Mix::Binary, Mix::Text, Mix::Mixed}) {
+        for (const std::int64_t payloadSize: {1, 8, 64, 1 << 10, 64 << 10, 1 << 20}) {
+            for (const auto fragmentation: {Fragmentation::None, Fragmentation::Split75, Fragmentation::Bytes,
+                                             Fragmentation::Segments, Fragmentation::Random}) {
+                benchmark->Args({static_cast<std::int64_t>(mix), payloadSize,
+                                 static_cast<std::int64_t>(fragmentation)});
+            }
+        }
+    }
+}
+
+BENCHMARK(BM_Receive)->Apply(receiveArguments);
+BENCHMARK(BM_BasicReceive)->Apply(receiveArguments);
+
+void BM_PackBinary(benchmark::State &state) {
+    std::size_t bytes = 0;
+    for (auto _: state) {
+        auto block = pack(std::make_tuple('a', 12345, 2.72f, 3.14, 42ull));
+        bytes += block.size();
+        benchmark::DoNotOptimize(block.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 5);
+    state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK(BM_PackBinary);
+
+void BM_PackText(benchmark::State &state) {
+    const std::string text(state.range(0), 't');
+    std::size_t bytes = 0;
+    for (auto _: state) {
+        auto block = pack(std::make_tuple(text.c_str(), text.c_str()));
+        bytes += block.size();
+        benchmark::DoNotOptimize(block.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+    state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK(BM_PackText)->RangeMultiplier(64)->Range(1, 1 << 20);
+
+void BM_PackMixed(benchmark::State &state) {
+    const std::string text(state.range(0), 't');
+    std::size_t bytes = 0;
+    for (auto _: state) {
+        auto block = pack(std::make_tuple(text.c_str(), 0xA0B0C0D, 2.72f, text.c_str(), 3.14));
+        bytes += block.size();
+        benchmark::DoNotOptimize(block.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 5);
+    state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK(BM_PackMixed)->RangeMultiplier(64)->Range(1, 1 << 20);
+
+void BM_PackIntoMixed(benchmark::State &state) {
+    const std::string text(state.range(0), 't');
+    std::vector<Byte> buffer(2 * text.size() + 64);
+    std::size_t bytes = 0;
+    for (auto _: state) {
+        const auto result = packInto(buffer, std::make_tuple(text.c_str(), 0xA0B0C0D, 2.72f, text.c_str(), 3.14));
+        bytes += result.size;
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 5);
+    state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK(BM_PackIntoMixed)->RangeMultiplier(64)->Range(1, 1 << 20);
+
+}
+
+BENCHMARK_MAIN();
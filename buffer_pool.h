@@ -0,0 +1,139 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Storage for the reassembly buffers of many receivers, in blocks of power-of-two size classes.
+// A receiver holds a block only while it has an incomplete frame and gives it back when its buffer
+// empties, so an idle connection costs no buffer memory. Blocks allocated, in use or pooled,
+// never exceed the budget: a receiver which can't get a block drops the frame it wanted to buffer
+// (FrameError::BufferLimit). Thread-safe, receivers on any threads may share a pool.
+struct BufferPool {
+    static constexpr std::size_t MIN_BLOCK_SIZE = 4 << 10;
+
+    // Free blocks are kept for reuse up to retainedBytes, beyond that they are freed.
+    explicit BufferPool(std::size_t budget_ = std::numeric_limits<std::size_t>::max(),
+                        std::size_t retainedBytes_ = 16 << 20)
+            : budgetBytes(budget_),
+              retainedBytes(retainedBytes_) {
+    }
+
+    // The receivers using the pool have to be gone before it.
+    ~BufferPool() {
+        trim();
+        assert(allocated == 0);
+    }
+
+    BufferPool(const BufferPool &pool) = delete;
+
+    BufferPool &operator=(const BufferPool &pool) = delete;
+
+    // A block of at least size bytes, whose size goes to capacity. nullptr if allocating it would
+    // take the pool over budget even after freeing the pooled blocks.
+    std::uint8_t *acquire(std::size_t size, std::size_t &capacity) {
+        if (size > std::numeric_limits<std::size_t>::max() / 2) {
+            return nullptr;
+        }
+        const auto sizeClass = classOf(size);
+        const auto blockSize = MIN_BLOCK_SIZE << sizeClass;
+        {
+            std::lock_guard lock(mutex);
+            auto &blocks = freeBlocks[sizeClass];
+            if (!blocks.empty()) {
+                auto *block = blocks.back();
+                blocks.pop_back();
+                pooled -= blockSize;
+                capacity = blockSize;
+                return block;
+            }
+            // pooled blocks of other sizes make room, the largest first
+            for (auto other = CLASSES; other-- > 0 && allocated + blockSize > budgetBytes;) {
+                while (!freeBlocks[other].empty() && allocated + blockSize > budgetBytes) {
+                    freeBlock(other);
+                }
+            }
+            if (allocated + blockSize > budgetBytes) {
+                return nullptr;
+            }
+            allocated += blockSize;
+        }
+        auto *block = new(std::nothrow) std::uint8_t[blockSize];
+        if (block == nullptr) {
+            std::lock_guard lock(mutex);
+            allocated -= blockSize;
+            return nullptr;
+        }
+        capacity = blockSize;
+        return block;
+    }
+
+    // Takes back a block of acquire, capacity is the size acquire gave.
+    void release(std::uint8_t *block, std::size_t capacity) noexcept {
+        const auto sizeClass = classOf(capacity);
+        std::lock_guard lock(mutex);
+        if (pooled + capacity <= retainedBytes) {
+            try {
+                freeBlocks[sizeClass].push_back(block);
+                pooled += capacity;
+                return;
+            } catch (const std::bad_alloc &) {
+                // freed below
+            }
+        }
+        allocated -= capacity;
+        delete[] block;
+    }
+
+    // Frees the pooled blocks, e.g. once a burst of large frames is over.
+    void trim() noexcept {
+        std::lock_guard lock(mutex);
+        for (std::size_t sizeClass = 0; sizeClass < CLASSES; ++sizeClass) {
+            while (!freeBlocks[sizeClass].empty()) {
+                freeBlock(sizeClass);
+            }
+        }
+    }
+
+    [[nodiscard]] std::size_t budget() const noexcept {
+        return budgetBytes;
+    }
+
+    // bytes of the blocks allocated, in use and pooled
+    [[nodiscard]] std::size_t allocatedBytes() const {
+        std::lock_guard lock(mutex);
+        return allocated;
+    }
+
+    [[nodiscard]] std::size_t pooledBytes() const {
+        std::lock_guard lock(mutex);
+        return pooled;
+    }
+
+private:
+    static constexpr std::size_t CLASSES = std::numeric_limits<std::size_t>::digits - std::bit_width(MIN_BLOCK_SIZE) + 1;
+
+    static std::size_t classOf(std::size_t size) noexcept {
+        return size <= MIN_BLOCK_SIZE ? 0 : std::bit_width((size - 1) / MIN_BLOCK_SIZE);
+    }
+
+    void freeBlock(std::size_t sizeClass) noexcept {
+        const auto blockSize = MIN_BLOCK_SIZE << sizeClass;
+        delete[] freeBlocks[sizeClass].back();
+        freeBlocks[sizeClass].pop_back();
+        pooled -= blockSize;
+        allocated -= blockSize;
+    }
+
+    const std::size_t budgetBytes;
+    const std::size_t retainedBytes;
+    mutable std::mutex mutex;
+    std::array<std::vector<std::uint8_t *>, CLASSES> freeBlocks;
+    std::size_t allocated = 0;
+    std::size_t pooled = 0;
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+
+#include <array>
+#include <tuple>
+#include <vector>
+
+#if __has_include(<lz4.h>)
+#include <lz4.h>
+#endif
+
+// Packs tuples like packTo, but values of threshold bytes and more go as compressed frames when
+// that makes them smaller. Smaller values keep the plain framing, and so the receiver's fast path.
+// The peer's receiver needs the same codec in its ReceiverConfig, and checksums on if they are
+// here: then binary and compressed frames get the CRC32C trailer. Throws like packTo.
+struct CompressingEncoder {
+    explicit CompressingEncoder(const ICodec &codec_, std::size_t threshold_ = 256, bool checksums_ = false)
+            : codec(codec_),
+              threshold(threshold_),
+              checksums(checksums_) {
+    }
+
+    CompressingEncoder(const CompressingEncoder &encoder) = delete;
+
+    CompressingEncoder &operator=(const CompressingEncoder &encoder) = delete;
+
+    template<typename OutputIt, typename ...Ts>
+    OutputIt encode(OutputIt out, const std::tuple<Ts...> &values) {
+        const auto layout = packLayout(values);
+        checkPayloadSizes(layout);
+        std::apply([this, &out, &layout](const auto &... args) {
+            std::size_t index = 0;
+            ((out = encodeValue(args, layout.lengths[index++], out)), ...);
+        }, values);
+        return out;
+    }
+
+private:
+    template<typename T, typename OutputIt>
+    OutputIt encodeValue(const T &value, std::size_t length, OutputIt out) {
+        // the original size of longer text doesn't fit the compressed header
+        if (length < threshold || length > MAX_PAYLOAD_SIZE) {
+            return packPlain(value, length, out);
+        }
+        const Byte *bytes;
+        if constexpr (IS_TEXT_VALUE<T>) {
+            bytes = reinterpret_cast<const Byte *>(value);
+        } else {
+            bytes = payloadBytes(value);
+        }
+        scratch.resize(codec.maxCompressedSize(length));
+        const auto compressedSize = codec.compress(bytes, length, scratch.data(), scratch.size());
+        if (compressedSize == 0 || COMPRESSED_HEADER_SIZE + compressedSize >= length) {
+            // doesn't pay off
+            return packPlain(value, length, out);
+        }
+        const auto frameSize = encodeBinSize(static_cast<BinSize>(COMPRESSED_HEADER_SIZE + compressedSize));
+        std::array<Byte, COMPRESSED_HEADER_SIZE> header{};
+        header[0] = static_cast<Byte>(IS_TEXT_VALUE<T> ? PacketType::Text : PacketType::Binary);
+        const auto originalSize = encodeBinSize(static_cast<BinSize>(length));
+        std::copy(originalSize.begin(), originalSize.end(), header.begin() + 1);
+        *out++ = START_BYTE_COMPRESSED_BLOCK;
+        out = std::copy(frameSize.begin(), frameSize.end(), out);
+        out = std::copy(header.begin(), header.end(), out);
+        out = std::copy(scratch.data(), scratch.data() + compressedSize, out);
+        if (checksums) {
+            // over the size field and the whole payload, as for a binary frame
+            auto checksum = crc32cUpdate(CRC32C_INIT, frameSize.data(), frameSize.size());
+            checksum = crc32cUpdate(checksum, header.data(), header.size());
+            checksum = crc32cUpdate(checksum, scratch.data(), compressedSize);
+            const auto trailer = encodeBinSize(crc32cFinish(checksum));
+            out = std::copy(trailer.begin(), trailer.end(), out);
+        }
+        return out;
+    }
+
+    template<typename T, typename OutputIt>
+    OutputIt packPlain(const T &value, std::size_t length, OutputIt out) const {
+        return checksums ? packChecksummedValue(value, length, out) : packValue(value, length, out);
+    }
+
+    const ICodec &codec;
+    std::size_t threshold;
+    bool checksums;
+    std::vector<Byte> scratch;
+};
+
+#if __has_include(<lz4.h>)
+// LZ4 block format, available when the lz4 headers are installed (link with liblz4).
+struct Lz4Codec : public ICodec {
+    [[nodiscard]] std::size_t maxCompressedSize(std::size_t size) const override {
+        return LZ4_compressBound(static_cast<int>(size));
+    }
+
+    std::size_t compress(const Byte *data, std::size_t size, Byte *out, std::size_t capacity) const override {
+        if (size > LZ4_MAX_INPUT_SIZE) {
+            return 0;
+        }
+        const auto result = LZ4_compress_default(reinterpret_cast<const char *>(data), reinterpret_cast<char *>(out),
+                                                 static_cast<int>(size), static_cast<int>(capacity));
+        return result > 0 ? result : 0;
+    }
+
+    bool decompress(const Byte *data, std::size_t size, Byte *out, std::size_t originalSize) const override {
+        const auto result = LZ4_decompress_safe(reinterpret_cast<const char *>(data), reinterpret_cast<char *>(out),
+                                                static_cast<int>(size), static_cast<int>(originalSize));
+        return result >= 0 && static_cast<std::size_t>(result) == originalSize;
+    }
+};
+#endif
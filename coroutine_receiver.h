@@ -0,0 +1,226 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+#include "packet_store.h"
+
+#include <coroutine>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <utility>
+
+// Receiver for C++20 coroutines: co_await nextPacket() gives the next packet, std::nullopt once the
+// receiver is closed and drained. A coroutine waiting for a packet is resumed from inside Receive,
+// with a view of the packet right where it was parsed: no copy, no queue, no allocation. Packets
+// which arrive while no coroutine waits are copied to a PacketStore and handed out first, in order.
+//
+// One coroutine awaits at a time, and it runs on the thread calling Receive, which mustn't be called
+// from the coroutine itself. A packet is valid until the coroutine awaits the next one or suspends
+// for anything else, to be kept longer it has to be copied. The coroutine mustn't be destroyed while
+// awaiting.
+//
+//     while (auto packet = co_await receiver.nextPacket()) {
+//         consume(*packet);
+//     }
+//
+// packets() gives the same as an async generator, whose iterator is awaited for each step:
+//
+//     auto packets = receiver.packets();
+//     for (auto it = co_await packets.begin(); it != packets.end(); co_await ++it) {
+//         consume(*it);
+//     }
+template<typename Tracer = DefaultTracer>
+struct CoroutineReceiver : public IReceiver {
+    struct PacketAwaiter {
+        [[nodiscard]] bool await_ready() const noexcept {
+            return owner.channel.hasPacket();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            owner.channel.waiter = handle;
+        }
+
+        std::optional<PacketView> await_resume() noexcept {
+            return owner.channel.takePacket();
+        }
+
+        CoroutineReceiver &owner;
+    };
+
+    struct PacketIterator;
+
+    // resumes with the iterator at the next packet, or at the end
+    struct AdvanceAwaiter {
+        [[nodiscard]] bool await_ready() const noexcept {
+            return iterator.owner->channel.hasPacket();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            iterator.owner->channel.waiter = handle;
+        }
+
+        PacketIterator &await_resume() noexcept {
+            iterator.current = iterator.owner->channel.takePacket();
+            return iterator;
+        }
+
+        PacketIterator &iterator;
+    };
+
+    // The current packet is valid as one of nextPacket() is. Equal to the end once the receiver is
+    // closed and drained.
+    struct PacketIterator {
+        [[nodiscard]] const PacketView &operator*() const noexcept {
+            return *current;
+        }
+
+        [[nodiscard]] const PacketView *operator->() const noexcept {
+            return &*current;
+        }
+
+        [[nodiscard]] AdvanceAwaiter operator++() noexcept {
+            return {*this};
+        }
+
+        [[nodiscard]] bool operator==(std::default_sentinel_t) const noexcept {
+            return !current;
+        }
+
+        CoroutineReceiver *owner;
+        std::optional<PacketView> current;
+    };
+
+    struct BeginAwaiter {
+        [[nodiscard]] bool await_ready() const noexcept {
+            return owner.channel.hasPacket();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            owner.channel.waiter = handle;
+        }
+
+        PacketIterator await_resume() noexcept {
+            return {&owner, owner.channel.takePacket()};
+        }
+
+        CoroutineReceiver &owner;
+    };
+
+    struct PacketStream {
+        [[nodiscard]] BeginAwaiter begin() noexcept {
+            return {owner};
+        }
+
+        [[nodiscard]] std::default_sentinel_t end() const noexcept {
+            return {};
+        }
+
+        CoroutineReceiver &owner;
+    };
+
+    // Packets stored for later go in chunks of storeChunkSize bytes, see PacketStore.
+    explicit CoroutineReceiver(ReceiverConfig config = {}, std::size_t storeChunkSize = 64 << 10, Tracer tracer = {})
+            : channel(storeChunkSize),
+              receiver(channel, config, std::move(tracer)) {
+    }
+
+    ~CoroutineReceiver() override = default;
+
+    CoroutineReceiver(const CoroutineReceiver &receiver) = delete;
+
+    CoroutineReceiver &operator=(const CoroutineReceiver &receiver) = delete;
+
+    void Receive(const Byte *data, std::size_t size) override {
+        receiver.Receive(data, size);
+    }
+
+    std::span<Byte> readBuffer(std::size_t size) {
+        return receiver.readBuffer(size);
+    }
+
+    void commitRead(std::size_t size) {
+        receiver.commitRead(size);
+    }
+
+    [[nodiscard]] PacketAwaiter nextPacket() noexcept {
+        return {*this};
+    }
+
+    // the packets as an async generator, one stream at a time like nextPacket()
+    [[nodiscard]] PacketStream packets() noexcept {
+        return {*this};
+    }
+
+    // Ends the packets: once the stored ones are taken, nextPacket() gives std::nullopt. A waiting
+    // coroutine gets it right away.
+    void close() {
+        channel.closed = true;
+        if (channel.waiter) {
+            std::exchange(channel.waiter, {}).resume();
+        }
+    }
+
+    // Frees the reassembly buffer as Receiver::trimBuffer() does, and the chunks of stored packets
+    // once they are all taken. For receivers gone idle.
+    void trimBuffer() {
+        receiver.trimBuffer();
+        if (channel.next == channel.store.size()) {
+            channel.store.release();
+            channel.next = 0;
+        }
+    }
+
+    // packets which arrived while no coroutine was waiting and weren't taken yet
+    [[nodiscard]] std::size_t storedPackets() const noexcept {
+        return channel.store.size() - channel.next;
+    }
+
+private:
+    struct Channel {
+        explicit Channel(std::size_t storeChunkSize)
+                : store(storeChunkSize) {
+        }
+
+        void Packets(std::span<const PacketView> packets) {
+            for (const auto &packet: packets) {
+                if (waiter) {
+                    // a coroutine waits only once the stored packets are taken, so the order holds
+                    current = packet;
+                    std::exchange(waiter, {}).resume();
+                } else {
+                    store.push(packet.type, packet.data, packet.size);
+                }
+            }
+        }
+
+        bool hasPacket() noexcept {
+            if (next > 0 && next == store.size()) {
+                // the packets taken are no longer used, the chunks are reused
+                store.clear();
+                next = 0;
+            }
+            return next < store.size() || closed;
+        }
+
+        std::optional<PacketView> takePacket() noexcept {
+            if (current) {
+                return std::exchange(current, std::nullopt);
+            }
+            if (next < store.size()) {
+                return store[next++];
+            }
+            return std::nullopt;
+        }
+
+        PacketStore store;
+        // the first stored packet not taken
+        std::size_t next = 0;
+        std::coroutine_handle<> waiter;
+        // the packet a waiting coroutine is resumed with
+        std::optional<PacketView> current;
+        bool closed = false;
+    };
+
+    Channel channel;
+    BasicReceiver<Channel &, Tracer> receiver;
+};
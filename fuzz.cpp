@@ -0,0 +1,179 @@
+#include "sender_receiver_bytes.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// Checks that the receiver delivers the same packets however a stream is cut into Receive calls.
+// Built as a libFuzzer target with clang (LIBFUZZER defined), as a standalone driver otherwise.
+
+namespace {
+
+// Packets as one byte string: type, size and bytes of each.
+struct RecordingHandler {
+    void Packets(std::span<const PacketView> packets) {
+        for (const auto &packet: packets) {
+            log.push_back(static_cast<Byte>(packet.type));
+            const auto size = encodeBinSize(static_cast<BinSize>(packet.size));
+            log.insert(log.end(), size.begin(), size.end());
+            log.insert(log.end(), packet.data, packet.data + packet.size);
+        }
+    }
+
+    std::vector<Byte> log;
+};
+
+struct Input {
+    const std::uint8_t *data;
+    std::size_t size;
+
+    [[nodiscard]] bool empty() const noexcept {
+        return size == 0;
+    }
+
+    std::uint8_t next() noexcept {
+        if (size == 0) {
+            return 0;
+        }
+        --size;
+        return *data++;
+    }
+};
+
+// A stream of packed values described by the input, which text can't break: no leading start byte,
+// no terminator inside.
+std::vector<Byte> makeStream(Input &input, bool checksums) {
+    std::vector<Byte> stream;
+    const auto append = [&stream, checksums](const auto &values) {
+        if (checksums) {
+            packChecksummedTo(std::back_inserter(stream), values);
+        } else {
+            packTo(std::back_inserter(stream), values);
+        }
+    };
+    while (!input.empty()) {
+        const auto op = input.next();
+        const std::size_t length = input.next() % 64 * (op & 0x80 ? 64 : 1);
+        switch (op % 3) {
+            case 0: {
+                std::uint32_t value = 0;
+                for (int i = 0; i < 4; ++i) {
+                    value = value << 8 | input.next();
+                }
+                append(std::make_tuple(value));
+                break;
+            }
+            case 1: {
+                std::string text;
+                for (std::size_t i = 0; i < length && !input.empty(); ++i) {
+                    auto c = static_cast<char>(input.next());
+                    if (c == '\n' || c == '\0' || (i == 0 && c == static_cast<char>(START_BYTE_BINARY_BLOCK))) {
+                        c = 'x';
+                    }
+                    text.push_back(c);
+                }
+                append(std::make_tuple(text.c_str()));
+                break;
+            }
+            default: {
+                std::vector<Byte> bytes(length);
+                for (auto &byte: bytes) {
+                    byte = input.next();
+                }
+                append(std::make_tuple(bytes));
+                break;
+            }
+        }
+    }
+    return stream;
+}
+
+std::vector<Byte> parse(const std::vector<Byte> &stream, const ReceiverConfig &config, std::minstd_rand *cuts,
+                        bool inPlace) {
+    // the in-place reads also take their buffers from a pool
+    BufferPool pool;
+    auto receiverConfig = config;
+    if (inPlace) {
+        receiverConfig.bufferPool = &pool;
+    }
+    BasicReceiver<RecordingHandler> receiver(RecordingHandler{}, receiverConfig);
+    std::size_t pos = 0;
+    while (pos < stream.size()) {
+        // mostly small pieces, some large ones
+        std::size_t count = stream.size() - pos;
+        if (cuts != nullptr) {
+            const auto draw = (*cuts)();
+            count = std::min<std::size_t>(count, 1 + (draw % 8 == 0 ? draw % 4096 : draw % 16));
+        }
+        if (inPlace) {
+            const auto buffer = receiver.readBuffer(count);
+            std::copy(stream.begin() + pos, stream.begin() + pos + count, buffer.begin());
+            receiver.commitRead(count);
+        } else {
+            receiver.Receive(stream.data() + pos, count);
+        }
+        pos += count;
+    }
+    return std::move(receiver.getHandler().log);
+}
+
+void check(const uint8_t *data, std::size_t size) {
+    Input input{data, size};
+    const auto mode = input.next();
+    std::vector<Byte> stream;
+    ReceiverConfig config{.maxBinaryPayload = 1 << 16, .maxTextLength = 1 << 16};
+    if (mode & 0x80) {
+        // text over the limit is dropped, also when it arrives in pieces
+        config.maxTextLength = 16;
+    }
+    if (mode % 3 == 0) {
+        // raw bytes, bad frames included; buffer limits would depend on the cuts
+        stream.assign(input.data, input.data + input.size);
+    } else {
+        config.checksums = mode % 3 == 2;
+        stream = makeStream(input, config.checksums);
+    }
+    const auto whole = parse(stream, config, nullptr, false);
+    std::minstd_rand cuts(mode * 2654435761u + size);
+    if (parse(stream, config, &cuts, false) != whole || parse(stream, config, &cuts, true) != whole) {
+        std::fprintf(stderr, "packets differ when the stream is cut\n");
+        std::abort();
+    }
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, std::size_t size) {
+    check(data, size);
+    return 0;
+}
+
+#if !defined(LIBFUZZER)
+// Runs the inputs in the files given, or the number of random inputs given (default 10000).
+int main(int argc, char **argv) {
+    if (argc > 1 && std::ifstream(argv[1]).good()) {
+        for (int i = 1; i < argc; ++i) {
+            std::ifstream file(argv[i], std::ios::binary);
+            const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            check(data.data(), data.size());
+        }
+        return 0;
+    }
+    const long runs = argc > 1 ? std::atol(argv[1]) : 10000;
+    std::mt19937 random(42);
+    std::vector<uint8_t> data;
+    for (long run = 0; run < runs; ++run) {
+        data.resize(random() % 4096);
+        for (auto &byte: data) {
+            byte = static_cast<uint8_t>(random());
+        }
+        check(data.data(), data.size());
+    }
+    std::printf("%ld inputs\n", runs);
+    return 0;
+}
+#endif
@@ -1,55 +1,32 @@
+#include "sender_receiver_bytes.h"
+#include "sender.h"
+#include "packet_store.h"
+#include "async_callback.h"
+#include "receiver_pool.h"
+#include "socket_reader.h"
+#include "replay.h"
+#include "compression.h"
+#include "coroutine_receiver.h"
+
 #include <iostream>
 #include <memory>
 #include <cstring>
-#include <iomanip>
 #include <random>
-#include <algorithm>
 #include <complex>
-#include <stack>
-#include <utility>
+#include <string_view>
+#include <string>
+#include <vector>
 #include <cassert>
+#include <map>
+#include <numeric>
+#include <mutex>
+#include <thread>
+#include <chrono>
 
-using Byte = uint8_t;
-
-constexpr Byte START_BYTE_BINARY_BLOCK = {0x24};
-constexpr auto ENDING_TEXT_BLOCK = std::array<Byte, 4 >{'\r', '\n', '\r', '\n'};
-union BinSize {
-    Byte bytes[4];
-    std::uint32_t size;
-};
-constexpr size_t BINARY_HEADER_SIZE = sizeof(START_BYTE_BINARY_BLOCK) + sizeof(BinSize);
-
-void print(const Byte *ptr, std::size_t size) noexcept {
-    std::cout << "==== Block byte size " << size << " bytes ====" << std::endl;
-    for (int i = 0; i < 16; ++i) {
-        std::cout << std::setfill('0') << std::setw(2) << std::uppercase << std::hex << i << "|" << std::dec;
-    }
-    std::cout << std::endl;
-    size_t pos = 0;
-    while (pos < size) {
-        const auto length = std::min(16, (int) (size - pos));
-        for (int i = 0; i < length; ++i) {
-            std::cout << std::setfill('0') << std::setw(2)
-                      << std::uppercase << std::hex << static_cast<int>(ptr[pos + i]) << "|" << std::dec;
-        }
-        std::cout << std::endl;
-        pos += length;
-    }
-}
-
-struct IReceiver {
-    virtual ~IReceiver() = default;
-
-    virtual void Receive(const Byte *data, std::size_t size) = 0;
-};
-
-struct ICallback {
-    virtual ~ICallback() = default;
-
-    virtual void BinaryPacket(const Byte *data, std::size_t size) = 0;
-
-    virtual void TextPacket(const Byte *data, std::size_t size) = 0;
-};
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 // callback isn't owner of data. copy data for safety.
 struct Callback : public ICallback {
@@ -64,174 +41,149 @@ struct Callback : public ICallback {
     Callback &operator=(const Callback &callback) = delete;
 
     void BinaryPacket(const Byte *data, std::size_t size) override {
-        std::cout << std::endl;
-        std::cout << "==== BinaryPacket ====" << std::endl;
-        print(data, size);
-        std::cout << std::endl;
-        values.push(std::vector<Byte>(data, data + size));
+        values.push(PacketType::Binary, data, size);
     }
 
     void TextPacket(const Byte *data, std::size_t size) override {
-        std::cout << std::endl;
-        std::cout << "==== TextPacket ====" << std::endl;
-        print(data, size);
-        std::cout << std::endl;
-        values.push(std::vector<Byte>(data, data + size));
+        values.push(PacketType::Text, data, size);
     }
 
-    std::stack<std::vector<Byte>> values;
+    PacketStore values;
 };
 
-struct Receiver : public IReceiver {
-    explicit Receiver(std::shared_ptr<ICallback> callback_)
-            : callback(std::move(callback_)) {
-    }
+struct NotPodType {
+    virtual ~NotPodType() = default;
+};
 
-    ~Receiver() override {
-        std::cout << __func__ << ", buffer size=" << buffer.size() << std::endl;
+template<typename ValueType>
+inline
+bool isTopValueEqual(const PacketStore &values, ValueType value) {
+    if (values.empty() || values.top().type != PacketType::Binary || values.top().size != sizeof(value)) {
+        return false;
     }
+    ValueType topValue;
+    std::memcpy(&topValue, values.top().data, sizeof(topValue));
+    return topValue == value;
+}
 
-    Receiver(const Receiver &receiver) = delete;
+inline
+bool isTopTextEqual(const PacketStore &values, std::string_view text) {
+    return !values.empty() && values.top().type == PacketType::Text &&
+           std::string_view(reinterpret_cast<const char *>(values.top().data), values.top().size) == text;
+}
 
-    Receiver &operator=(const Receiver &receiver) = delete;
+// partSize of receiveInParts: pieces of 1 to 16 bytes, cut at random positions
+constexpr std::size_t RANDOM_PARTS = 0;
 
-    void Receive(const Byte *data, std::size_t size) override {
-        std::cout << __func__ << " data=" << std::hex << reinterpret_cast<long>(data)
-                  << std::dec << ", size=" << size << std::endl;
+// Feeds block to the receiver in pieces of partSize bytes, the last one may be shorter.
+template<typename ReceiverType>
+void receiveInParts(ReceiverType &receiver, std::span<const Byte> block, std::size_t partSize) {
+    std::minstd_rand random(block.size());
+    for (std::size_t pos = 0; pos < block.size();) {
+        const std::size_t part = partSize != RANDOM_PARTS ? partSize : 1 + random() % 16;
+        const auto count = std::min(part, block.size() - pos);
+        receiver.Receive(block.data() + pos, count);
+        pos += count;
+    }
+}
 
-        if (size == 0) {
-            return;
+// coroutine which runs eagerly and frees itself when done
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept {
+            return {};
         }
 
-        if (!buffer.empty()) {
-            // append to buffer
-            std::copy(data, data + size, std::back_inserter(buffer));
-            data = buffer.data();
-            size = buffer.size();
+        std::suspend_never initial_suspend() noexcept {
+            return {};
         }
 
-        const auto beginData = data;
-        const auto endData = data + size;
-        const auto *ptr = data;
-        while (ptr < endData) {
-            if (*ptr == START_BYTE_BINARY_BLOCK) {
-                const size_t left = endData - ptr;
-                if (left > BINARY_HEADER_SIZE) {
-                    ptr += sizeof(START_BYTE_BINARY_BLOCK);
-                    const auto payloadSize = __bswap_32(BinSize{ptr[0],
-                                                                ptr[1],
-                                                                ptr[2],
-                                                                ptr[3]}.size);
-                    ptr += sizeof(BinSize);
-                    const size_t left = endData - ptr;
-                    if (payloadSize <= left) {
-                        callback->BinaryPacket(ptr, payloadSize);
-                        ptr += payloadSize;
-                        data = ptr;
-                    } else {
-                        ptr = data;
-                        break;
-                    }
-                } else {
-                    break;
-                }
-            } else {
-                const auto it = std::search(ptr, endData,
-                                            std::begin(ENDING_TEXT_BLOCK),
-                                            std::end(ENDING_TEXT_BLOCK));
-                if (it != endData) {
-                    // text and separator in a block
-                    const std::ptrdiff_t packetSize = it - ptr;
-                    callback->TextPacket(ptr, packetSize);
-                    ptr += packetSize + ENDING_TEXT_BLOCK.size();
-                } else {
-                    break;
-                }
-            }
+        std::suspend_never final_suspend() noexcept {
+            return {};
         }
 
-        const std::ptrdiff_t processedBytes = ptr - beginData;
-        const std::size_t unprocessedBytes = size - processedBytes;
-        if (!buffer.empty() && processedBytes > 0) {
-            // remove processedBytes from buffer
-            buffer.erase(buffer.begin(), buffer.begin() + processedBytes);
-        } else if (buffer.empty() && unprocessedBytes > 0) {
-            // unprocessed bytes not in buffer
-            std::copy(ptr, ptr + unprocessedBytes, std::back_inserter(buffer));
+        void return_void() noexcept {
         }
-    }
 
-private:
-    std::shared_ptr<ICallback> callback;
-    std::vector<Byte> buffer;
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
 };
 
-template<typename T>
-std::size_t pack(T value, std::size_t pos, Byte * const ptr) noexcept {
-    ptr[pos] = START_BYTE_BINARY_BLOCK;
-    pos += sizeof(START_BYTE_BINARY_BLOCK);
-    std::memcpy(ptr + pos,
-            // to little-endian
-                BinSize{.size = __bswap_32(sizeof(value))}.bytes,
-                sizeof(BinSize));
-    pos += sizeof(BinSize);
-    std::memcpy(ptr + pos, &value, sizeof(value));
-    pos += sizeof(value);
-    return pos;
+DetachedTask consumePackets(CoroutineReceiver<> &receiver, std::vector<std::string> &texts, long long &sum, bool &done) {
+    while (auto packet = co_await receiver.nextPacket()) {
+        if (packet->type == PacketType::Text) {
+            texts.emplace_back(reinterpret_cast<const char *>(packet->data), packet->size);
+        } else {
+            long long value;
+            std::memcpy(&value, packet->data, sizeof(value));
+            sum += value;
+        }
+    }
+    done = true;
 }
 
-template<>
-std::size_t pack<const char *>(const char *value, std::size_t pos, Byte * const ptr) noexcept {
-    const std::size_t size = std::strlen(value);
-    std::copy(value, value + size, ptr + pos);
-    pos += size;
-    std::copy(std::begin(ENDING_TEXT_BLOCK), std::end(ENDING_TEXT_BLOCK), ptr + pos);
-    pos += ENDING_TEXT_BLOCK.size();
-    return pos;
+// the same through the async generator
+DetachedTask consumePacketStream(CoroutineReceiver<> &receiver, std::vector<std::string> &texts, long long &sum,
+                                 bool &done) {
+    auto packets = receiver.packets();
+    for (auto it = co_await packets.begin(); it != packets.end(); co_await ++it) {
+        if (it->type == PacketType::Text) {
+            texts.emplace_back(reinterpret_cast<const char *>(it->data), it->size);
+        } else {
+            long long value;
+            std::memcpy(&value, (*it).data, sizeof(value));
+            sum += value;
+        }
+    }
+    done = true;
 }
 
-template<typename ...Ts>
-auto pack(std::tuple<Ts...> &&values) noexcept {
-    const std::size_t sizeBlock = std::apply([](auto &&... args) {
-        std::size_t size = 0;
-        ((
-                [&size](auto &&value) {
-                    using Type = typename std::decay<decltype(value)>::type;
-                    static_assert(std::is_pod<Type>::value, "type is not a pod");
-                    if constexpr (std::is_same<const char *, Type>::value) {
-                        size += std::strlen(value) + ENDING_TEXT_BLOCK.size();
-                    } else {
-                        size += BINARY_HEADER_SIZE + sizeof(Type);
-                    }
-                }(args)
-        ), ...);
-        return size;
-    }, values);
-
-    auto block = std::vector<Byte>(sizeBlock);
-    std::apply([&block](auto &&... args) {
-        std::size_t pos = 0;
-        ((
-                [&pos, &block](auto &&value) {
-                    pos = pack(value, pos, block.data());
-                }(args)
-        ), ...);
-    }, values);
-    return std::move(block);
-}
+int main() {
+    std::mt19937 mt(std::random_device{}());
 
-struct NotPodType {
-    virtual ~NotPodType() = default;
-};
+    // test the binary size codec, sizes go in network byte order
+    {
+        static_assert(encodeBinSize(0x01020304) == std::array<Byte, 4>{0x01, 0x02, 0x03, 0x04});
+        constexpr std::array<Byte, 4> bytes{0x0A, 0x0B, 0x0C, 0x0D};
+        static_assert(decodeBinSize(bytes.data()) == 0x0A0B0C0D);
+        assert(decodeBinSize(bytes.data()) == 0x0A0B0C0D);
+        const auto block = pack(std::make_tuple(42));
+        assert(block.size() == BINARY_HEADER_SIZE + sizeof(int));
+        assert(decodeBinSize(block.data() + 1) == sizeof(int));
+    }
 
-template<typename ValueType>
-inline
-bool isTopValueEqual(std::stack<std::vector<Byte>> values, ValueType value) {
-    return !values.empty() && *reinterpret_cast<ValueType *>(values.top().data()) == value;
-}
+    // test blocks of pods packed at compile time
+    {
+        constexpr auto block = pack(std::make_tuple('a', 0x01020304, std::uint16_t{0x0506}));
+        static_assert(std::is_same_v<decltype(block), const std::array<Byte, 3 * BINARY_HEADER_SIZE + 7>>);
+        static_assert(block[0] == START_BYTE_BINARY_BLOCK && decodeBinSize(block.data() + 1) == 1 && block[5] == 'a');
+        static_assert(decodeBinSize(block.data() + 7) == sizeof(int));
+        std::vector<Byte> stream;
+        packTo(std::back_inserter(stream), std::make_tuple('a', 0x01020304, std::uint16_t{0x0506}));
+        assert(std::equal(block.begin(), block.end(), stream.begin(), stream.end()));
+    }
 
-int main() {
-    std::mt19937 mt(std::random_device{}());
+    // test delimiter scanners against the scalar algorithms
+    {
+        std::vector<Byte> text(100, 'a');
+        for (std::size_t i = 0; i + ENDING_TEXT_BLOCK.size() <= text.size(); ++i) {
+            auto block = text;
+            // partial terminators must not match
+            block[i / 2] = '\r';
+            block[i / 2 + 1] = '\n';
+            std::copy(std::begin(ENDING_TEXT_BLOCK), std::end(ENDING_TEXT_BLOCK), block.begin() + i);
+            block[i / 3] = START_BYTE_BINARY_BLOCK;
+            const auto *first = block.data();
+            const auto *last = block.data() + block.size();
+            assert(findTextEnding(first, last) ==
+                   std::search(first, last, std::begin(ENDING_TEXT_BLOCK), std::end(ENDING_TEXT_BLOCK)));
+            assert(findByte(first, last, START_BYTE_BINARY_BLOCK) == std::find(first, last, START_BYTE_BINARY_BLOCK));
+        }
+        assert(findTextEnding(text.data(), text.data() + text.size()) == text.data() + text.size());
+        assert(findByte(text.data(), text.data() + text.size(), START_BYTE_BINARY_BLOCK) == text.data() + text.size());
+    }
     auto callback = std::make_shared<Callback>();
     auto receiver = std::make_unique<Receiver>(callback);
 
@@ -246,7 +198,7 @@ int main() {
 //                                  std::make_pair(4, 2),
 //                                  std::complex<int>(4, 2),
 //                                  NotPodType(),
-                                  42ui
+                                  42u
                           )
         );
         print(block.data(), block.size());
@@ -267,6 +219,1118 @@ int main() {
         receiver->Receive(block.data(), block.size());
     }
 
+    // test packing into reused buffers
+    {
+        const auto values = std::make_tuple("456", 0xA0B0C0D, 2.72f, "", 'c');
+        const auto block = pack(std::tuple(values));
+        std::vector<Byte> buffer(block.size() - 1);
+        auto result = packInto(buffer, values);
+        assert(!result.fits && result.size == block.size());
+        buffer.resize(block.size() + 1);
+        result = packInto(buffer, values);
+        assert(result.fits && result.size == block.size());
+        assert(std::equal(block.begin(), block.end(), buffer.begin()));
+        std::vector<Byte> stream;
+        packTo(std::back_inserter(stream), values);
+        packTo(std::back_inserter(stream), values);
+        assert(stream.size() == 2 * block.size());
+        assert(std::equal(block.begin(), block.end(), stream.begin() + block.size()));
+        // a payload too big for its size field isn't framed, reserved memory which is never read
+        const std::size_t hugeSize = MAX_PAYLOAD_SIZE + 1;
+        void *huge = mmap(nullptr, hugeSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (huge != MAP_FAILED) {
+            const auto hugeValues = std::make_tuple(1, std::span<const Byte>(static_cast<const Byte *>(huge), hugeSize));
+            assert(!packInto(buffer, hugeValues).fits);
+            bool rejected = false;
+            try {
+                packTo(std::back_inserter(stream), hugeValues);
+            } catch (const std::length_error &) {
+                rejected = true;
+            }
+            assert(rejected && stream.size() == 2 * block.size());
+            munmap(huge, hugeSize);
+        }
+    }
+
+    // test gather encoding and sending through a pipe
+    {
+        const std::string text(1000, 't');
+        const auto values = std::make_tuple("456", 0xA0B0C0D, text.c_str(), 2.72f, 3.14, "");
+        const auto block = pack(std::tuple(values));
+        GatherEncoder encoder;
+        const auto iovecs = encoder.encode(values);
+        // header of 0xA0B0C0D | text | terminator and the rest
+        assert(iovecs.size() == 3);
+        assert(iovecs[1].iov_base == text.c_str());
+        std::vector<Byte> gathered;
+        for (const auto &iov: iovecs) {
+            const auto *base = static_cast<const Byte *>(iov.iov_base);
+            gathered.insert(gathered.end(), base, base + iov.iov_len);
+        }
+        assert(gathered == block && encoder.size() == block.size());
+
+        int fds[2];
+        const auto created = pipe(fds);
+        assert(created == 0);
+        SocketSender sender(fds[1]);
+        const auto sent = sender.Send(iovecs);
+        assert(sent == block.size());
+        std::vector<Byte> received(block.size());
+        std::size_t receivedSize = 0;
+        while (receivedSize < received.size()) {
+            const auto result = read(fds[0], received.data() + receivedSize, received.size() - receivedSize);
+            assert(result > 0);
+            receivedSize += result;
+        }
+        close(fds[0]);
+        close(fds[1]);
+        assert(received == block);
+    }
+
+    // test batching frames before sending
+    {
+        struct RecordingSender : public ISender {
+            std::size_t Send(std::span<const iovec> buffers) override {
+                ++calls;
+                std::size_t size = 0;
+                for (const auto &buffer: buffers) {
+                    const auto *data = static_cast<const Byte *>(buffer.iov_base);
+                    bytes.insert(bytes.end(), data, data + buffer.iov_len);
+                    size += buffer.iov_len;
+                }
+                return size;
+            }
+
+            std::vector<Byte> bytes;
+            std::size_t calls = 0;
+        };
+        RecordingSender sender;
+        const std::string bigText(100, 'b');
+        {
+            FrameBatcher batcher(sender, {.maxBytes = 64, .maxFrames = 4, .maxDelay = std::chrono::hours(1)});
+            // four frames of a binary block each
+            for (int i = 0; i < 4; ++i) {
+                const bool added = batcher.add(std::make_tuple(i));
+                assert(added);
+            }
+            assert(sender.calls == 1 && batcher.pendingFrames() == 0);
+            // the byte threshold
+            for (int i = 0; i < 6; ++i) {
+                batcher.add(std::make_tuple(i, i));
+            }
+            assert(sender.calls == 2 && batcher.pendingFrames() == 3);
+            // too big for the buffer, goes after the batch
+            batcher.add(std::make_tuple(bigText.c_str()));
+            assert(sender.calls == 4 && batcher.pendingFrames() == 0);
+            batcher.add(std::make_tuple("urgent"));
+            batcher.flush();
+            assert(sender.calls == 5);
+            batcher.add(std::make_tuple("last"));
+        }
+        // the destructor sent the rest
+        assert(sender.calls == 6);
+        {
+            FrameBatcher batcher(sender, {.maxDelay = std::chrono::microseconds(100)});
+            batcher.add(std::make_tuple('d'));
+            assert(batcher.pendingFrames() == 1);
+            std::this_thread::sleep_until(batcher.deadline());
+            batcher.poll();
+            assert(batcher.pendingFrames() == 0 && sender.calls == 7);
+        }
+        auto batchCallback = std::make_shared<Callback>();
+        Receiver batchReceiver(batchCallback);
+        batchReceiver.Receive(sender.bytes.data(), sender.bytes.size());
+        assert(batchCallback->values.size() == 4 + 12 + 4);
+        assert(isTopValueEqual(batchCallback->values, 'd'));
+        batchCallback->values.pop();
+        assert(isTopTextEqual(batchCallback->values, "last"));
+        batchCallback->values.pop();
+        batchCallback->values.pop();
+        assert(isTopTextEqual(batchCallback->values, bigText));
+        // with checksums, batched and oversized blocks alike get their trailers
+        RecordingSender checkedSender;
+        const std::vector<Byte> bigBlock(100, 0x5A);
+        std::vector<Byte> expected;
+        {
+            FrameBatcher batcher(checkedSender, {.maxBytes = 64, .checksums = true});
+            for (int i = 0; i < 3; ++i) {
+                batcher.add(std::make_tuple(i, "text"));
+                packChecksummedTo(std::back_inserter(expected), std::make_tuple(i, "text"));
+            }
+            batcher.add(std::make_tuple(bigBlock, 7));
+            packChecksummedTo(std::back_inserter(expected), std::make_tuple(bigBlock, 7));
+        }
+        assert(checkedSender.bytes == expected);
+    }
+
+    // test retaining packets in chunks
+    {
+        PacketStore store(16);
+        BasicReceiver<PacketStore &> storeReceiver(store);
+        const std::string text(40, 't');
+        const auto block = pack(std::make_tuple('a', 12345, text.c_str(), 3.14));
+        storeReceiver.Receive(block.data(), block.size());
+        assert(store.size() == 4);
+        assert(isTopValueEqual(store, 3.14));
+        assert(store[2].size == text.size() && std::equal(text.begin(), text.end(), store[2].data));
+        const auto capacity = store.capacity();
+        store.clear();
+        assert(store.empty());
+        storeReceiver.Receive(block.data(), block.size());
+        assert(store.size() == 4 && store.capacity() == capacity);
+        store.pop();
+        assert(isTopTextEqual(store, text));
+    }
+
+    // test handing packets over to a consumer thread through a small ring
+    {
+        auto consumerCallback = std::make_shared<Callback>();
+        {
+            auto asyncCallback = std::make_shared<AsyncCallback>(consumerCallback, 64);
+            Receiver asyncReceiver(asyncCallback);
+            for (int i = 0; i < 1000; ++i) {
+                const auto block = pack(std::make_tuple(i, "text"));
+                asyncReceiver.Receive(block.data(), block.size());
+            }
+            assert(asyncCallback->droppedPackets() == 0);
+        }
+        assert(consumerCallback->values.size() == 2000);
+        for (int i = 999; i >= 0; --i) {
+            assert(isTopTextEqual(consumerCallback->values, "text"));
+            consumerCallback->values.pop();
+            assert(isTopValueEqual(consumerCallback->values, i));
+            consumerCallback->values.pop();
+        }
+        // packets bigger than a record go in parts, none is lost
+        const std::vector<Byte> large(5000, 0x5A);
+        const std::string longText(600, 't');
+        const auto block = pack(std::make_tuple(large, longText.c_str(), 7));
+        {
+            auto asyncCallback = std::make_shared<AsyncCallback>(consumerCallback, 1 << 10);
+            Receiver asyncReceiver(asyncCallback);
+            asyncReceiver.Receive(block.data(), block.size());
+            assert(asyncCallback->droppedPackets() == 0);
+        }
+        assert(consumerCallback->values.size() == 3 && isTopValueEqual(consumerCallback->values, 7));
+        consumerCallback->values.pop();
+        assert(isTopTextEqual(consumerCallback->values, longText));
+        consumerCallback->values.pop();
+        assert(consumerCallback->values.top().size == large.size());
+        assert(std::equal(large.begin(), large.end(), consumerCallback->values.top().data));
+        // a slow consumer costs whole packets only, never pieces of a stream
+        struct SlowStreamCallback : public ICallback {
+            void BinaryPacket(const Byte *, std::size_t) override {
+            }
+
+            void TextPacket(const Byte *, std::size_t) override {
+            }
+
+            void BinaryBegin(std::size_t) override {
+                ++begins;
+            }
+
+            void BinaryChunk(const Byte *, std::size_t size) override {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                streamed += size;
+            }
+
+            void BinaryEnd() override {
+                ++ends;
+            }
+
+            std::size_t begins = 0;
+            std::size_t ends = 0;
+            std::size_t streamed = 0;
+        };
+        auto slowCallback = std::make_shared<SlowStreamCallback>();
+        {
+            auto asyncCallback = std::make_shared<AsyncCallback>(slowCallback, 256, AsyncCallback::Overflow::Drop);
+            Receiver asyncReceiver(asyncCallback, {.streamBinaryFrom = 1000});
+            const auto streamedBlock = pack(std::make_tuple(std::vector<Byte>(20000, 0x5A)));
+            receiveInParts(asyncReceiver, streamedBlock, 100);
+        }
+        assert(slowCallback->begins == 1 && slowCallback->ends == 1 && slowCallback->streamed == 20000);
+    }
+
+    // test spreading streams over shards
+    {
+        std::mutex mutex;
+        std::map<StreamId, std::shared_ptr<Callback>> callbacks;
+        {
+            ReceiverPool pool([&mutex, &callbacks](StreamId stream) {
+                std::lock_guard lock(mutex);
+                return callbacks[stream] = std::make_shared<Callback>();
+            }, 3, 256);
+            const auto block = pack(std::make_tuple("text", 1234, std::array<Byte, 200>{}));
+            // streams interleaved byte by byte
+            for (std::size_t i = 0; i < block.size(); ++i) {
+                for (StreamId stream = 0; stream < 10; ++stream) {
+                    pool.Receive(stream, block.data() + i, 1);
+                }
+            }
+            pool.Receive(10, block.data(), block.size() - 1);
+            pool.Close(10);
+            pool.Receive(10, block.data(), block.size());
+        }
+        assert(callbacks.size() == 11);
+        for (const auto &[stream, streamCallback]: callbacks) {
+            assert(streamCallback->values.size() == 3);
+            assert(streamCallback->values.top().size == 200);
+            streamCallback->values.pop();
+            assert(isTopValueEqual(streamCallback->values, 1234));
+        }
+        // the streams' receivers get the pool's config
+        callbacks.clear();
+        ReceiverStats poolStats;
+        {
+            ReceiverPool pool([&mutex, &callbacks](StreamId stream) {
+                std::lock_guard lock(mutex);
+                return callbacks[stream] = std::make_shared<Callback>();
+            }, 2, 256, {.maxTextLength = 2, .stats = &poolStats});
+            const auto block = pack(std::make_tuple("text", 1234));
+            for (StreamId stream = 0; stream < 4; ++stream) {
+                pool.Receive(stream, block.data(), block.size());
+            }
+        }
+        assert(callbacks.size() == 4 && poolStats.counts().droppedFrames == 4);
+        for (const auto &[stream, streamCallback]: callbacks) {
+            assert(streamCallback->values.size() == 1 && isTopValueEqual(streamCallback->values, 1234));
+        }
+    }
+
+    // test dropping frames over the limits and resynchronizing
+    {
+        struct ErrorCallback : public Callback {
+            void InvalidFrame(FrameError error) override {
+                errors.push_back(error);
+            }
+
+            std::vector<FrameError> errors;
+        };
+        const ReceiverConfig config{.maxBinaryPayload = 16, .maxTextLength = 8, .maxBufferedBytes = 12};
+        std::vector<Byte> block = {START_BYTE_BINARY_BLOCK, 0x7F, 0xFF, 0xFF, 0xFF, 'x', 'y'};
+        for (auto part: {pack(std::make_tuple("garbage", 42, "long text", std::array<Byte, 16>{})),
+                         pack(std::make_tuple("ok", 7))}) {
+            block.insert(block.end(), part.begin(), part.end());
+        }
+        for (const std::size_t partSize: {block.size(), std::size_t{1}, RANDOM_PARTS}) {
+            auto errorCallback = std::make_shared<ErrorCallback>();
+            Receiver limitedReceiver(errorCallback, config);
+            receiveInParts(limitedReceiver, block, partSize);
+            // the oversized frame swallows "garbage" up to its terminator, the long text is dropped in
+            // one piece and the array is over the buffer limit when it's not received at once
+            const bool whole = partSize == block.size();
+            assert(errorCallback->values.size() == (whole ? 4 : 3));
+            assert(isTopValueEqual(errorCallback->values, 7));
+            errorCallback->values.pop();
+            assert(isTopTextEqual(errorCallback->values, "ok"));
+            const auto expected = whole
+                                  ? std::vector{FrameError::BinaryTooLarge, FrameError::TextTooLong}
+                                  : std::vector{FrameError::BinaryTooLarge, FrameError::TextTooLong,
+                                                FrameError::BufferLimit};
+            assert(errorCallback->errors == expected);
+        }
+        // a start byte inside dropped text is text, however the text is cut
+        std::vector<Byte> dollarBlock;
+        packTo(std::back_inserter(dollarBlock), std::make_tuple("long text with $ inside it", 1, "ok", 2));
+        for (const std::size_t partSize: {dollarBlock.size(), std::size_t{5}, std::size_t{1}, RANDOM_PARTS}) {
+            auto errorCallback = std::make_shared<ErrorCallback>();
+            Receiver limitedReceiver(errorCallback, {.maxTextLength = 8});
+            receiveInParts(limitedReceiver, dollarBlock, partSize);
+            assert(errorCallback->errors == std::vector{FrameError::TextTooLong});
+            assert(errorCallback->values.size() == 3 && isTopValueEqual(errorCallback->values, 2));
+            errorCallback->values.pop();
+            assert(isTopTextEqual(errorCallback->values, "ok"));
+        }
+        // A garbage size is scanned again for start bytes, also when its header was buffered: the
+        // frame starting inside it gets through wherever the stream is cut. With checksums the
+        // trailer of a corrupt frame may look like such a header.
+        for (const bool checksums: {false, true}) {
+            std::vector<Byte> garbageBlock;
+            if (checksums) {
+                packChecksummedTo(std::back_inserter(garbageBlock), std::make_tuple(1));
+                garbageBlock[BINARY_HEADER_SIZE] ^= 0x02;
+                garbageBlock[BINARY_HEADER_SIZE + sizeof(int)] = START_BYTE_BINARY_BLOCK;
+                garbageBlock[BINARY_HEADER_SIZE + sizeof(int) + 1] = 0xFF;
+                packChecksummedTo(std::back_inserter(garbageBlock), std::make_tuple(7, "ok"));
+            } else {
+                garbageBlock = {START_BYTE_BINARY_BLOCK, 0xFF};
+                packTo(std::back_inserter(garbageBlock), std::make_tuple(7, "ok"));
+            }
+            for (std::size_t cut = 0; cut <= garbageBlock.size(); ++cut) {
+                auto errorCallback = std::make_shared<ErrorCallback>();
+                Receiver limitedReceiver(errorCallback, {.maxBinaryPayload = 1000, .checksums = checksums});
+                limitedReceiver.Receive(garbageBlock.data(), cut);
+                limitedReceiver.Receive(garbageBlock.data() + cut, garbageBlock.size() - cut);
+                assert(errorCallback->values.size() == 2 && isTopTextEqual(errorCallback->values, "ok"));
+                errorCallback->values.pop();
+                assert(isTopValueEqual(errorCallback->values, 7));
+            }
+        }
+        // errors pass through the consumer thread in order with the packets
+        struct OrderCallback : public ICallback {
+            void BinaryPacket(const Byte *, std::size_t) override {
+                events.push_back('B');
+            }
+
+            void TextPacket(const Byte *, std::size_t) override {
+                events.push_back('T');
+            }
+
+            void InvalidFrame(FrameError) override {
+                events.push_back('E');
+            }
+
+            std::string events;
+        };
+        auto orderCallback = std::make_shared<OrderCallback>();
+        {
+            Receiver asyncReceiver(std::make_shared<AsyncCallback>(orderCallback, 256), {.maxTextLength = 8});
+            asyncReceiver.Receive(dollarBlock.data(), dollarBlock.size());
+        }
+        assert(orderCallback->events == "EBTB");
+    }
+
+    // test streaming large binary payloads without buffering them
+    {
+        struct StreamCallback : public Callback {
+            void BinaryBegin(std::size_t size) override {
+                assert(streamed.empty() && !streaming);
+                streaming = true;
+                expectedSize = size;
+            }
+
+            void BinaryChunk(const Byte *data, std::size_t size) override {
+                assert(streaming);
+                streamed.insert(streamed.end(), data, data + size);
+            }
+
+            void BinaryEnd() override {
+                assert(streaming && streamed.size() == expectedSize);
+                streaming = false;
+                values.push(PacketType::Binary, streamed.data(), streamed.size());
+                streamed.clear();
+            }
+
+            std::vector<Byte> streamed;
+            bool streaming = false;
+            std::size_t expectedSize = 0;
+        };
+        std::array<Byte, 100> payload{};
+        for (std::size_t i = 0; i < payload.size(); ++i) {
+            payload[i] = static_cast<Byte>(i);
+        }
+        const auto block = pack(std::make_tuple(1, payload, "text", payload, 2));
+        const ReceiverConfig config{.maxBufferedBytes = 16, .streamBinaryFrom = 32};
+        for (const std::size_t partSize: {block.size(), std::size_t{7}, std::size_t{1}}) {
+            for (const bool async: {false, true}) {
+                auto streamCallback = std::make_shared<StreamCallback>();
+                {
+                    auto receiverCallback = async
+                                            ? std::static_pointer_cast<ICallback>(
+                                                    std::make_shared<AsyncCallback>(streamCallback, 64))
+                                            : std::static_pointer_cast<ICallback>(streamCallback);
+                    Receiver streamReceiver(receiverCallback, config);
+                    receiveInParts(streamReceiver, block, partSize);
+                }
+                assert(streamCallback->values.size() == 5);
+                assert(isTopValueEqual(streamCallback->values, 2));
+                streamCallback->values.pop();
+                assert(isTopValueEqual(streamCallback->values, payload));
+                streamCallback->values.pop();
+                streamCallback->values.pop();
+                assert(isTopValueEqual(streamCallback->values, payload));
+            }
+        }
+    }
+
+    // test streaming long text without buffering it
+    {
+        struct StreamCallback : public Callback {
+            void TextBegin() override {
+                assert(!streaming);
+                streaming = true;
+            }
+
+            void TextChunk(const Byte *data, std::size_t size) override {
+                assert(streaming && size > 0);
+                streamed.insert(streamed.end(), data, data + size);
+            }
+
+            void TextEnd() override {
+                assert(streaming);
+                streaming = false;
+                values.push(PacketType::Text, streamed.data(), streamed.size());
+                streamed.clear();
+            }
+
+            std::vector<Byte> streamed;
+            bool streaming = false;
+        };
+        const std::string longText = "long\r\n\r text\r\r\n\rwith partial\r\n terminators\r";
+        const auto block = pack(std::make_tuple(longText.c_str(), "short", 1, longText.c_str(), 2));
+        const ReceiverConfig config{.maxBufferedBytes = 10, .streamTextFrom = 8};
+        for (std::size_t partSize = 1; partSize <= block.size(); ++partSize) {
+            for (const bool async: {false, true}) {
+                auto streamCallback = std::make_shared<StreamCallback>();
+                {
+                    auto receiverCallback = async
+                                            ? std::static_pointer_cast<ICallback>(
+                                                    std::make_shared<AsyncCallback>(streamCallback, 256))
+                                            : std::static_pointer_cast<ICallback>(streamCallback);
+                    Receiver streamReceiver(receiverCallback, config);
+                    receiveInParts(streamReceiver, block, partSize);
+                }
+                assert(streamCallback->values.size() == 5);
+                assert(isTopValueEqual(streamCallback->values, 2));
+                streamCallback->values.pop();
+                assert(isTopTextEqual(streamCallback->values, longText));
+                streamCallback->values.pop();
+                streamCallback->values.pop();
+                assert(isTopTextEqual(streamCallback->values, "short"));
+                streamCallback->values.pop();
+                assert(isTopTextEqual(streamCallback->values, longText));
+            }
+        }
+    }
+
+    // test binary frames with checksums
+    {
+        const std::string check = "123456789";
+        assert(crc32c(reinterpret_cast<const Byte *>(check.data()), check.size()) == 0xE3069283);
+        // the same in pieces and past the word loop
+        std::vector<Byte> bytes(1000);
+        for (std::size_t i = 0; i < bytes.size(); ++i) {
+            // no start byte or terminator in there
+            bytes[i] = static_cast<Byte>(0x80 | i % 127);
+        }
+        auto crc = crc32cUpdate(CRC32C_INIT, bytes.data(), 333);
+        crc = crc32cUpdate(crc, bytes.data() + 333, bytes.size() - 333);
+        std::uint32_t bitwise = CRC32C_INIT;
+        for (const auto byte: bytes) {
+            bitwise ^= byte;
+            for (int bit = 0; bit < 8; ++bit) {
+                bitwise = (bitwise >> 1) ^ (0x82F63B78 & (0u - (bitwise & 1)));
+            }
+        }
+        assert(crc32cFinish(crc) == crc32cFinish(bitwise));
+        assert(crc32cUpdateTables(CRC32C_INIT, bytes.data(), bytes.size()) == bitwise);
+#if defined(CRC32C_HARDWARE)
+        // the instructions and the tables agree at every length and alignment
+        if (hasCrc32cInstructions()) {
+            for (std::size_t offset = 0; offset < 8; ++offset) {
+                for (std::size_t size = 0; size + offset <= 40; ++size) {
+                    assert(crc32cUpdateHardware(CRC32C_INIT, bytes.data() + offset, size) ==
+                           crc32cUpdateTables(CRC32C_INIT, bytes.data() + offset, size));
+                }
+            }
+            assert(crc32cUpdateHardware(CRC32C_INIT, bytes.data(), bytes.size()) == bitwise);
+        }
+#endif
+
+        std::vector<Byte> block;
+        packChecksummedTo(std::back_inserter(block), std::make_tuple(1, bytes, "text", 2));
+        assert(block.size() == 3 * (BINARY_HEADER_SIZE + CHECKSUM_SIZE) + 2 * sizeof(int) + bytes.size() + 8);
+        for (const std::size_t partSize: {block.size(), std::size_t{7}, std::size_t{1}}) {
+            auto checkedCallback = std::make_shared<Callback>();
+            Receiver checkedReceiver(checkedCallback, {.checksums = true});
+            receiveInParts(checkedReceiver, block, partSize);
+            assert(checkedCallback->values.size() == 4);
+            assert(isTopValueEqual(checkedCallback->values, 2));
+            checkedCallback->values.pop();
+            checkedCallback->values.pop();
+            assert(checkedCallback->values.top().size == bytes.size());
+            assert(std::equal(bytes.begin(), bytes.end(), checkedCallback->values.top().data));
+        }
+        // A corrupt size or payload drops the frame, the next ones get through however the stream
+        // is cut, also when the corrupt size claims the frames after it.
+        for (const std::size_t corruptAt: {std::size_t{4}, std::size_t{6}}) {
+            for (const std::size_t partSize: {block.size(), std::size_t{7}, std::size_t{1}, RANDOM_PARTS}) {
+                auto corrupt = block;
+                corrupt[corruptAt] ^= 0x01;
+                auto checkedCallback = std::make_shared<Callback>();
+                Receiver checkedReceiver(checkedCallback, {.checksums = true});
+                receiveInParts(checkedReceiver, corrupt, partSize);
+                assert(checkedCallback->values.size() == 3);
+                assert(isTopValueEqual(checkedCallback->values, 2));
+            }
+        }
+        // streamed payloads are checked at their end
+        struct StreamChecker {
+            void BinaryPacket(const Byte *, std::size_t) noexcept {
+            }
+
+            void TextPacket(const Byte *, std::size_t) noexcept {
+            }
+
+            void BinaryBegin(std::size_t) noexcept {
+            }
+
+            void BinaryChunk(const Byte *, std::size_t size) noexcept {
+                streamed += size;
+            }
+
+            void BinaryEnd() noexcept {
+                ++ends;
+            }
+
+            void InvalidFrame(FrameError error) noexcept {
+                badChecksums += error == FrameError::BadChecksum;
+            }
+
+            std::size_t streamed = 0;
+            std::size_t ends = 0;
+            std::size_t badChecksums = 0;
+        };
+        for (const bool corrupted: {false, true}) {
+            auto streamedBlock = block;
+            if (corrupted) {
+                streamedBlock[2 * BINARY_HEADER_SIZE + CHECKSUM_SIZE + sizeof(int) + 500] ^= 0x01;
+            }
+            BasicReceiver streamChecker(StreamChecker{}, {.streamBinaryFrom = 100, .checksums = true});
+            for (std::size_t pos = 0; pos < streamedBlock.size(); pos += 7) {
+                streamChecker.Receive(streamedBlock.data() + pos, std::min<std::size_t>(7, streamedBlock.size() - pos));
+            }
+            const auto &checker = streamChecker.getHandler();
+            assert(checker.streamed == bytes.size() && checker.ends == 1 && checker.badChecksums == corrupted);
+            assert(streamChecker.bufferedBytes() == 0);
+        }
+    }
+
+    // test compressed frames
+    {
+        // run-length pairs of count and byte
+        struct RleCodec : public ICodec {
+            [[nodiscard]] std::size_t maxCompressedSize(std::size_t size) const override {
+                return 2 * size;
+            }
+
+            std::size_t compress(const Byte *data, std::size_t size, Byte *out, std::size_t /*capacity*/) const override {
+                std::size_t written = 0;
+                for (std::size_t i = 0; i < size;) {
+                    std::size_t run = 1;
+                    while (i + run < size && run < 255 && data[i + run] == data[i]) {
+                        ++run;
+                    }
+                    out[written++] = static_cast<Byte>(run);
+                    out[written++] = data[i];
+                    i += run;
+                }
+                return written;
+            }
+
+            bool decompress(const Byte *data, std::size_t size, Byte *out, std::size_t originalSize) const override {
+                std::size_t written = 0;
+                for (std::size_t i = 0; i + 1 < size; i += 2) {
+                    if (written + data[i] > originalSize) {
+                        return false;
+                    }
+                    std::fill_n(out + written, data[i], data[i + 1]);
+                    written += data[i];
+                }
+                return size % 2 == 0 && written == originalSize;
+            }
+        };
+        const RleCodec codec;
+        CompressingEncoder encoder(codec, 16);
+        const std::string text(1000, 'z');
+        std::array<Byte, 300> zeros{};
+        std::vector<Byte> block;
+        encoder.encode(std::back_inserter(block), std::make_tuple(1, text.c_str(), zeros, "small", text.c_str()));
+        // the long text and the zeros are compressed, the rest isn't worth it
+        assert(block.size() < 100);
+        assert(block[BINARY_HEADER_SIZE + sizeof(int)] == START_BYTE_COMPRESSED_BLOCK);
+        for (const std::size_t partSize: {block.size(), std::size_t{7}, std::size_t{1}}) {
+            auto compressedCallback = std::make_shared<Callback>();
+            Receiver compressedReceiver(compressedCallback, {.codec = &codec});
+            receiveInParts(compressedReceiver, block, partSize);
+            assert(compressedCallback->values.size() == 5);
+            assert(isTopTextEqual(compressedCallback->values, text));
+            compressedCallback->values.pop();
+            assert(isTopTextEqual(compressedCallback->values, "small"));
+            compressedCallback->values.pop();
+            assert(isTopValueEqual(compressedCallback->values, zeros));
+            compressedCallback->values.pop();
+            assert(isTopTextEqual(compressedCallback->values, text));
+        }
+        // a corrupt frame and one of a text over the limit are dropped, the stream goes on
+        auto corrupt = block;
+        corrupt[BINARY_HEADER_SIZE + sizeof(int) + BINARY_HEADER_SIZE + COMPRESSED_HEADER_SIZE] = 0;
+        auto corruptCallback = std::make_shared<Callback>();
+        Receiver corruptReceiver(corruptCallback, {.maxTextLength = 100, .codec = &codec});
+        corruptReceiver.Receive(corrupt.data(), corrupt.size());
+        assert(corruptCallback->values.size() == 3);
+        assert(isTopTextEqual(corruptCallback->values, "small"));
+        // checksummed compressed frames, also indexed in a capture
+        CompressingEncoder checkedEncoder(codec, 16, true);
+        std::vector<Byte> checkedBlock;
+        checkedEncoder.encode(std::back_inserter(checkedBlock), std::make_tuple(1, text.c_str(), zeros, "small"));
+        auto checkedCallback = std::make_shared<Callback>();
+        Receiver checkedReceiver(checkedCallback, {.codec = &codec, .checksums = true});
+        checkedReceiver.Receive(checkedBlock.data(), checkedBlock.size());
+        assert(checkedCallback->values.size() == 4 && isTopTextEqual(checkedCallback->values, "small"));
+        const auto checkedIndex = indexFrames(checkedBlock.data(), checkedBlock.size(),
+                                              {.codec = &codec, .checksums = true});
+        assert(checkedIndex.size() == 4 && checkedIndex.indexedBytes == checkedBlock.size());
+        assert(checkedIndex.sizes[0] == sizeof(int) && checkedIndex.compressed[2] == 1);
+        // a tiny frame claiming gigabytes is dropped before any storage is taken, the storage of
+        // a decompressed packet goes back to the pool after delivery
+        BufferPool pool;
+        PacketStore inflatedStore;
+        BasicReceiver<PacketStore &> pooledReceiver(inflatedStore, {.codec = &codec, .bufferPool = &pool});
+        const std::array<Byte, 11> bomb{START_BYTE_COMPRESSED_BLOCK, 0, 0, 0, 6, 1, 0xF0, 0, 0, 0, 0};
+        pooledReceiver.Receive(bomb.data(), bomb.size());
+        assert(inflatedStore.empty() && pooledReceiver.droppedBytes() == bomb.size() && pool.allocatedBytes() == 0);
+        pooledReceiver.Receive(block.data(), block.size());
+        assert(inflatedStore.size() == 5 && pool.allocatedBytes() == pool.pooledBytes());
+        // a capture of compressed frames is indexed by their header, not scanned as text
+        const auto index = indexFrames(block.data(), block.size(), {.codec = &codec});
+        assert(index.size() == 5 && index.compressed[1] == 1 && index.types[1] == PacketType::Text);
+        std::size_t decodedBytes = 0;
+        decodeFrames(block.data(), index, 2, [&decodedBytes](std::size_t, std::span<const PacketView> packets) {
+            for (const auto &packet: packets) {
+                decodedBytes += packet.size;
+            }
+        }, &codec);
+        assert(decodedBytes == sizeof(int) + text.size() + zeros.size() + 5 + text.size());
+        for (const auto range: splitAtFrames(block.data(), block.size(), 5, {.codec = &codec})) {
+            assert(indexFrames(range.data(), range.size(), {.codec = &codec}).indexedBytes == range.size());
+        }
+#if defined(HAVE_LZ4)
+        // the same packets with LZ4, decompressed into storage kept between frames
+        const Lz4Codec lz4;
+        CompressingEncoder lz4Encoder(lz4, 16);
+        std::vector<Byte> lz4Block;
+        lz4Encoder.encode(std::back_inserter(lz4Block), std::make_tuple(1, text.c_str(), zeros, "small", text.c_str()));
+        assert(lz4Block.size() < 200 && lz4Block[BINARY_HEADER_SIZE + sizeof(int)] == START_BYTE_COMPRESSED_BLOCK);
+        for (const std::size_t partSize: {lz4Block.size(), std::size_t{7}, RANDOM_PARTS}) {
+            auto lz4Callback = std::make_shared<Callback>();
+            Receiver lz4Receiver(lz4Callback, {.codec = &lz4});
+            receiveInParts(lz4Receiver, lz4Block, partSize);
+            assert(lz4Callback->values.size() == 5 && isTopTextEqual(lz4Callback->values, text));
+            lz4Callback->values.pop();
+            assert(isTopTextEqual(lz4Callback->values, "small"));
+            lz4Callback->values.pop();
+            assert(isTopValueEqual(lz4Callback->values, zeros));
+        }
+#endif
+    }
+
+    // test receiver stats
+    {
+        static_assert(Histogram::bucketOf(7) == 7 && Histogram::bucketOf(8) == 8 && Histogram::bucketOf(16) == 16);
+        static_assert(Histogram::lowestOf(Histogram::bucketOf(1000)) <= 1000);
+        static_assert(Histogram::highestOf(Histogram::bucketOf(1000)) >= 1000);
+        static_assert(Histogram::bucketOf(~std::uint64_t{0}) == Histogram::BUCKETS - 1);
+        Histogram histogram;
+        for (std::uint64_t value = 1; value <= 1000; ++value) {
+            histogram.record(value);
+        }
+        assert(histogram.count() == 1000);
+        // within the bucket precision
+        assert(histogram.percentile(50) >= 500 && histogram.percentile(50) < 500 * 9 / 8 + 1);
+        assert(histogram.max() >= 1000 && histogram.max() < 1000 * 9 / 8 + 1);
+
+        ReceiverStats stats(true);
+        auto statsCallback = std::make_shared<Callback>();
+        Receiver statsReceiver(statsCallback, {.maxTextLength = 100, .stats = &stats});
+        const std::string longText(200, 't');
+        const auto block = pack(std::make_tuple(1, "text", longText.c_str(), 2));
+        // whole header and half of the payload, then the rest
+        statsReceiver.Receive(block.data(), 7);
+        statsReceiver.Receive(block.data() + 7, block.size() - 7);
+        const auto counts = stats.counts();
+        assert(counts.receiveCalls == 2 && counts.partialFrames == 1 && counts.droppedFrames == 1);
+        assert(counts.binaryPackets == 2 && counts.binaryBytes == 2 * sizeof(int));
+        assert(counts.textPackets == 1 && counts.textBytes == 4);
+        assert(counts.reassembledPackets == 1);
+        // the packets before the dropped text are a batch of their own
+        assert(stats.latency().count() == 2);
+        assert(stats.depth().count() == 1 && stats.depth().max() >= 7);
+    }
+
+    // test reading into the reassembly buffer
+    {
+        const auto block = pack(std::make_tuple(1, "text\r\n\rsplit", std::array<Byte, 100>{}, "", 2));
+        for (const std::size_t partSize: {block.size(), std::size_t{7}, std::size_t{1}}) {
+            auto readCallback = std::make_shared<Callback>();
+            Receiver readReceiver(readCallback);
+            for (std::size_t pos = 0; pos < block.size(); pos += partSize) {
+                const auto count = std::min(partSize, block.size() - pos);
+                // a buffer bigger than what gets read, as with a socket
+                const auto buffer = readReceiver.readBuffer(count + 16);
+                std::memcpy(buffer.data(), block.data() + pos, count);
+                readReceiver.commitRead(count);
+            }
+            assert(readCallback->values.size() == 5);
+            assert(isTopValueEqual(readCallback->values, 2));
+            readCallback->values.pop();
+            assert(isTopTextEqual(readCallback->values, ""));
+            readCallback->values.pop();
+            readCallback->values.pop();
+            assert(isTopTextEqual(readCallback->values, "text\r\n\rsplit"));
+        }
+    }
+
+    // test reading sockets through epoll
+    {
+        constexpr int CONNECTIONS = 3;
+        std::vector<int> closedFds;
+        EpollReader<> reader([&closedFds](int fd, int error) {
+            assert(error == 0);
+            closedFds.push_back(fd);
+        }, 16);
+        std::vector<std::shared_ptr<Callback>> callbacks;
+        std::vector<std::unique_ptr<Receiver>> receivers;
+        std::array<std::array<int, 2>, CONNECTIONS> sockets{};
+        for (int i = 0; i < CONNECTIONS; ++i) {
+            assert(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets[i].data()) == 0);
+            ::fcntl(sockets[i][0], F_SETFL, ::fcntl(sockets[i][0], F_GETFL) | O_NONBLOCK);
+            callbacks.push_back(std::make_shared<Callback>());
+            receivers.push_back(std::make_unique<Receiver>(callbacks.back()));
+            const bool added = reader.add(sockets[i][0], *receivers.back());
+            assert(added);
+        }
+        const std::string text(100, 't');
+        const auto block = pack(std::make_tuple(text.c_str(), 42, "end"));
+        for (std::size_t pos = 0; pos < block.size(); pos += 33) {
+            for (int i = 0; i < CONNECTIONS; ++i) {
+                const auto count = std::min<std::size_t>(33, block.size() - pos);
+                const auto written = ::write(sockets[i][1], block.data() + pos, count);
+                assert(written == static_cast<ssize_t>(count));
+            }
+            const int ready = reader.poll(1000);
+            assert(ready == CONNECTIONS);
+        }
+        for (int i = 0; i < CONNECTIONS; ++i) {
+            assert(callbacks[i]->values.size() == 3);
+            assert(isTopTextEqual(callbacks[i]->values, "end"));
+            ::close(sockets[i][1]);
+        }
+        while (reader.size() > 0) {
+            reader.poll(1000);
+        }
+        assert(closedFds.size() == CONNECTIONS);
+        for (int i = 0; i < CONNECTIONS; ++i) {
+            ::close(sockets[i][0]);
+        }
+    }
+
+    // test replaying a capture file
+    {
+        char path[] = "/tmp/sender_receiver_bytes_XXXXXX";
+        const int fd = ::mkstemp(path);
+        assert(fd >= 0);
+        std::vector<Byte> capture;
+        constexpr int FRAMES = 100;
+        for (int i = 0; i < FRAMES; ++i) {
+            packTo(std::back_inserter(capture), std::make_tuple(i, "te$t"));
+        }
+        const auto written = ::write(fd, capture.data(), capture.size());
+        assert(written == static_cast<ssize_t>(capture.size()));
+        ::close(fd);
+        MappedFile file;
+        const bool opened = file.open(path, true);
+        assert(opened && file.size() == capture.size());
+        ::unlink(path);
+
+        auto replayCallback = std::make_shared<Callback>();
+        Receiver replayReceiver(replayCallback);
+        replay(file, replayReceiver);
+        assert(replayCallback->values.size() == 2 * FRAMES);
+        assert(isTopTextEqual(replayCallback->values, "te$t"));
+
+        const auto ranges = splitAtFrames(file.data(), file.size(), 3);
+        assert(ranges.size() == 3 && ranges.front().data() == file.data());
+        for (const auto &range: ranges) {
+            assert(nextFrame(range.data(), range.data() + range.size()) != nullptr);
+        }
+        std::array<std::shared_ptr<Callback>, 3> rangeCallbacks;
+        parallelReplay(file, 3, [&rangeCallbacks](std::size_t index) {
+            rangeCallbacks[index] = std::make_shared<Callback>();
+            return std::make_unique<Receiver>(rangeCallbacks[index]);
+        });
+        std::size_t total = 0;
+        for (const auto &callback: rangeCallbacks) {
+            // ranges start at frame boundaries, so no packet is lost or cut
+            assert(!callback->values.empty());
+            total += callback->values.size();
+        }
+        assert(total == 2 * FRAMES);
+    }
+
+    // test two-phase decode through a frame index
+    {
+        std::vector<Byte> buffer;
+        constexpr int FRAMES = 1000;
+        for (int i = 0; i < FRAMES; ++i) {
+            packTo(std::back_inserter(buffer), std::make_tuple(i, "text"));
+        }
+        // an incomplete frame at the end isn't indexed
+        buffer.push_back(START_BYTE_BINARY_BLOCK);
+        const auto index = indexFrames(buffer.data(), buffer.size());
+        assert(index.size() == 2 * FRAMES && index.indexedBytes == buffer.size() - 1);
+        assert(index.types[0] == PacketType::Binary && index.sizes[0] == sizeof(int));
+        assert(index.types[1] == PacketType::Text && index.sizes[1] == 4);
+        constexpr std::size_t PARTS = 4;
+        std::array<long long, PARTS> sums{};
+        std::array<std::size_t, PARTS> texts{};
+        decodeFrames(buffer.data(), index, PARTS, [&sums, &texts](std::size_t part, std::span<const PacketView> packets) {
+            for (const auto &packet: packets) {
+                if (packet.type == PacketType::Binary) {
+                    int value;
+                    std::memcpy(&value, packet.data, sizeof(value));
+                    sums[part] += value;
+                } else {
+                    assert(std::string_view(reinterpret_cast<const char *>(packet.data), packet.size) == "text");
+                    ++texts[part];
+                }
+            }
+        });
+        assert(std::accumulate(sums.begin(), sums.end(), 0ll) == FRAMES * (FRAMES - 1) / 2);
+        assert(std::accumulate(texts.begin(), texts.end(), std::size_t{0}) == FRAMES);
+    }
+
+    // test reassembly buffers from a pool with a budget
+    {
+        BufferPool pool(32 << 10);
+        PacketStore store(16);
+        BasicReceiver<PacketStore &> pooledReceiver(store, ReceiverConfig{.bufferPool = &pool});
+        const auto frame = pack(std::make_tuple(std::vector<Byte>(10000, 0x5A)));
+        pooledReceiver.Receive(frame.data(), frame.size() / 2);
+        assert(pooledReceiver.bufferCapacity() == 8 << 10);
+        pooledReceiver.Receive(frame.data() + frame.size() / 2, frame.size() - frame.size() / 2);
+        assert(store.size() == 1 && store[0].size == 10000);
+        // the emptied buffer went back to the pool
+        assert(pooledReceiver.bufferCapacity() == 0);
+        assert(pool.allocatedBytes() == 24 << 10 && pool.pooledBytes() == 24 << 10);
+        // one which would take the pool over budget is dropped
+        const auto largeFrame = pack(std::make_tuple(std::vector<Byte>(40000, 0x5A)));
+        const auto value = pack(std::make_tuple(42));
+        pooledReceiver.Receive(largeFrame.data(), 20000);
+        // the pooled blocks were freed to make room
+        assert(pooledReceiver.bufferCapacity() == 32 << 10 && pool.allocatedBytes() == 32 << 10);
+        pooledReceiver.Receive(largeFrame.data() + 20000, largeFrame.size() - 20000);
+        assert(pooledReceiver.droppedBytes() == largeFrame.size() && pooledReceiver.bufferCapacity() == 0);
+        pooledReceiver.Receive(value.data(), value.size());
+        assert(store.size() == 2 && isTopValueEqual(store, 42));
+        pool.trim();
+        assert(pool.allocatedBytes() == 0);
+
+        // without a pool the buffer keeps its capacity until trimmed
+        BasicReceiver<PacketStore &> plainReceiver(store);
+        plainReceiver.Receive(largeFrame.data(), 20000);
+        plainReceiver.Receive(largeFrame.data() + 20000, largeFrame.size() - 20000);
+        plainReceiver.Receive(value.data(), 3);
+        assert(plainReceiver.bufferCapacity() >= largeFrame.size());
+        plainReceiver.trimBuffer();
+        assert(plainReceiver.bufferCapacity() == 3 && plainReceiver.bufferedBytes() == 3);
+        plainReceiver.Receive(value.data() + 3, value.size() - 3);
+        assert(store.size() == 4 && isTopValueEqual(store, 42));
+        plainReceiver.trimBuffer();
+        assert(plainReceiver.bufferCapacity() == 0);
+    }
+
+    // test awaiting packets in a coroutine
+    {
+        CoroutineReceiver<> coroutineReceiver;
+        std::vector<std::string> texts;
+        long long sum = 0;
+        bool done = false;
+        // arriving before anyone waits, they are stored
+        const auto early = pack(std::make_tuple(1ll, "first", 2ll));
+        coroutineReceiver.Receive(early.data(), early.size());
+        assert(coroutineReceiver.storedPackets() == 3);
+        consumePackets(coroutineReceiver, texts, sum, done);
+        assert(coroutineReceiver.storedPackets() == 0 && sum == 3 && texts.size() == 1);
+        // the waiting coroutine takes them straight from Receive, also when they're reassembled
+        const auto late = pack(std::make_tuple(10ll, "second", 20ll, "third"));
+        for (std::size_t pos = 0; pos < late.size(); pos += 3) {
+            coroutineReceiver.Receive(late.data() + pos, std::min<std::size_t>(3, late.size() - pos));
+        }
+        coroutineReceiver.Receive(late.data(), late.size());
+        assert(coroutineReceiver.storedPackets() == 0 && sum == 63);
+        assert((texts == std::vector<std::string>{"first", "second", "third", "second", "third"}));
+        assert(!done);
+        coroutineReceiver.close();
+        assert(done);
+
+        // the async generator, fed from before the first step to a trimmed reassembly buffer
+        CoroutineReceiver<> streamReceiver;
+        std::vector<std::string> streamTexts;
+        long long streamSum = 0;
+        bool streamDone = false;
+        streamReceiver.Receive(early.data(), early.size());
+        consumePacketStream(streamReceiver, streamTexts, streamSum, streamDone);
+        assert(streamReceiver.storedPackets() == 0 && streamSum == 3);
+        streamReceiver.Receive(late.data(), late.size() / 2);
+        streamReceiver.trimBuffer();
+        streamReceiver.Receive(late.data() + late.size() / 2, late.size() - late.size() / 2);
+        assert(streamSum == 33 && (streamTexts == std::vector<std::string>{"first", "second", "third"}));
+        assert(!streamDone);
+        streamReceiver.close();
+        assert(streamDone);
+    }
+
+    // test sending text packet parted at every byte, terminator included
+    {
+        const auto block = pack(std::make_tuple("text\r\n\rsplit\r\r\nend", 7));
+        for (const auto byte: block) {
+            receiver->Receive(&byte, 1);
+        }
+        assert(isTopValueEqual(callback->values, 7));
+        callback->values.pop();
+        assert(isTopTextEqual(callback->values, "text\r\n\rsplit\r\r\nend"));
+        callback->values.pop();
+    }
+
+    // test sending mixed data packets split in two parts at every position
+    {
+        const auto block = pack(std::make_tuple(3.14, "text", 'c', "", 42, "end"));
+        for (std::size_t i = 0; i <= block.size(); ++i) {
+            receiver->Receive(block.data(), i);
+            receiver->Receive(block.data() + i, block.size() - i);
+            assert(isTopTextEqual(callback->values, "end"));
+            callback->values.pop();
+            assert(isTopValueEqual(callback->values, 42));
+            callback->values.pop();
+            assert(isTopTextEqual(callback->values, ""));
+            callback->values.pop();
+            assert(isTopValueEqual(callback->values, 'c'));
+            callback->values.pop();
+            assert(isTopTextEqual(callback->values, "text"));
+            callback->values.pop();
+            assert(isTopValueEqual(callback->values, 3.14));
+            callback->values.pop();
+        }
+    }
+
+    // test receiving all packets of a block in one batch
+    {
+        struct BatchCallback : public ICallback {
+            void BinaryPacket(const Byte *, std::size_t) override {
+                assert(false);
+            }
+
+            void TextPacket(const Byte *, std::size_t) override {
+                assert(false);
+            }
+
+            void Packets(std::span<const PacketView> packets) override {
+                batches.emplace_back(packets.begin(), packets.end());
+            }
+
+            std::vector<std::vector<PacketView>> batches;
+        };
+        auto batchCallback = std::make_shared<BatchCallback>();
+        Receiver batchReceiver(batchCallback);
+        const auto block = pack(std::make_tuple('a', "text", 42));
+        batchReceiver.Receive(block.data(), block.size() - 1);
+        batchReceiver.Receive(block.data() + block.size() - 1, 1);
+        assert(batchCallback->batches.size() == 2);
+        assert(batchCallback->batches[0].size() == 2);
+        assert(batchCallback->batches[0][0].type == PacketType::Binary && batchCallback->batches[0][0].size == 1);
+        assert(batchCallback->batches[0][1].type == PacketType::Text && batchCallback->batches[0][1].size == 4);
+        assert(batchCallback->batches[1].size() == 1);
+        assert(batchCallback->batches[1][0].type == PacketType::Binary && batchCallback->batches[1][0].size == 4);
+        // many packets in one call are delivered in batches of a bounded size
+        std::vector<Byte> manyBlock;
+        for (int i = 0; i < 3000; ++i) {
+            packTo(std::back_inserter(manyBlock), std::make_tuple(i));
+        }
+        batchCallback->batches.clear();
+        batchReceiver.Receive(manyBlock.data(), manyBlock.size());
+        assert(batchCallback->batches.size() == 3);
+        assert(batchCallback->batches[0].size() == MAX_BATCH_PACKETS);
+        assert(batchCallback->batches[2].size() == 3000 % MAX_BATCH_PACKETS);
+        int last;
+        std::memcpy(&last, batchCallback->batches[2].back().data, sizeof(last));
+        assert(last == 2999);
+    }
+
+    // test receiving with a statically dispatched handler
+    {
+        struct SumHandler {
+            void BinaryPacket(const Byte *data, std::size_t size) noexcept {
+                int value = 0;
+                assert(size == sizeof(value));
+                std::memcpy(&value, data, size);
+                sum += value;
+            }
+
+            void TextPacket(const Byte *, std::size_t size) noexcept {
+                textBytes += size;
+            }
+
+            int sum = 0;
+            std::size_t textBytes = 0;
+        };
+        BasicReceiver<SumHandler> sumReceiver(SumHandler{});
+        const auto block = pack(std::make_tuple(1, "text", 2, 3));
+        for (const auto byte: block) {
+            sumReceiver.Receive(&byte, 1);
+        }
+        assert(sumReceiver.getHandler().sum == 6);
+        assert(sumReceiver.getHandler().textBytes == 4);
+        assert(sumReceiver.bufferedBytes() == 0);
+    }
+
+    // test typed decode of packed blocks
+    {
+        struct Decoded {
+            int id;
+            std::string name;
+            double value;
+        };
+        std::vector<Decoded> decoded;
+        const auto first = pack(std::make_tuple(1, "first", 2.5));
+        // a double where the int is expected, then a block the string of which arrives in pieces
+        const auto second = pack(std::make_tuple(3.5, 2, "second", 0.5));
+        std::vector<Byte> block(first.begin(), first.end());
+        block.insert(block.end(), second.begin(), second.end());
+        for (const std::size_t partSize: {block.size(), std::size_t{7}, std::size_t{1}}) {
+            decoded.clear();
+            BasicReceiver unpackReceiver(unpack<int, const char *, double>(
+                    [&decoded](int id, std::string_view name, double value) {
+                        decoded.push_back({id, std::string(name), value});
+                    }));
+            receiveInParts(unpackReceiver, block, partSize);
+            assert(decoded.size() == 2);
+            assert(decoded[0].id == 1 && decoded[0].name == "first" && decoded[0].value == 2.5);
+            assert(decoded[1].id == 2 && decoded[1].name == "second" && decoded[1].value == 0.5);
+            assert(unpackReceiver.getHandler().mismatches() == 1);
+        }
+    }
+
+    // test arrays packed as one block and viewed typed
+    {
+        std::vector<float> samples(1000);
+        for (std::size_t i = 0; i < samples.size(); ++i) {
+            samples[i] = static_cast<float>(i) / 4;
+        }
+        const std::array<std::uint16_t, 3> counters{1, 2, 3};
+        const auto block = pack(std::make_tuple(7, std::span<const float>(samples), counters, std::vector<double>{}));
+        assert(block.size() == 4 * BINARY_HEADER_SIZE + sizeof(int) + samples.size() * sizeof(float) + sizeof(counters));
+        GatherEncoder encoder;
+        const auto iovecs = encoder.encode(std::make_tuple(7, std::span<const float>(samples)));
+        // the samples are referenced in place
+        assert(iovecs.size() == 2 && iovecs[1].iov_base == samples.data());
+        for (const std::size_t partSize: {block.size(), std::size_t{7}, std::size_t{1}}) {
+            std::size_t calls = 0;
+            BasicReceiver arrayReceiver(unpack<int, std::vector<float>, std::array<std::uint16_t, 3>, std::span<double>>(
+                    [&](int id, PodArrayView<float> view, std::array<std::uint16_t, 3> values, PodArrayView<double> empty) {
+                        ++calls;
+                        assert(id == 7 && values == counters && empty.empty());
+                        assert(view.size() == samples.size() && view[999] == samples[999]);
+                        std::vector<float> copy(view.size());
+                        view.copyTo(copy.data());
+                        assert(copy == samples);
+                    }));
+            receiveInParts(arrayReceiver, block, partSize);
+            assert(calls == 1 && arrayReceiver.getHandler().mismatches() == 0);
+        }
+    }
+
     // test sending parted mixed data packets
     {
         const auto value1 = static_cast<long long>(123456789);
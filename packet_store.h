@@ -0,0 +1,122 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+
+#include <algorithm>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Keeps copies of packets in large chunks instead of one allocation per packet. Chunks are
+// reused after clear(), so a store filled and released in bulk allocates only while it grows.
+// Views stay valid until the packet is popped or the store is cleared.
+struct PacketStore {
+    explicit PacketStore(std::size_t chunkSize_ = 1 << 20)
+            : chunkSize(chunkSize_) {
+    }
+
+    PacketStore(const PacketStore &store) = delete;
+
+    PacketStore &operator=(const PacketStore &store) = delete;
+
+    void push(PacketType type, const Byte *data, std::size_t size) {
+        auto *ptr = allocate(size);
+        std::copy(data, data + size, ptr);
+        packets.push_back({type, ptr, size});
+    }
+
+    // Can be used as a BasicReceiver handler directly.
+    void Packets(std::span<const PacketView> views) {
+        for (const auto &view: views) {
+            push(view.type, view.data, view.size);
+        }
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return packets.empty();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return packets.size();
+    }
+
+    [[nodiscard]] std::span<const PacketView> views() const noexcept {
+        return packets;
+    }
+
+    PacketView operator[](std::size_t index) const noexcept {
+        return packets[index];
+    }
+
+    // the last pushed packet
+    [[nodiscard]] PacketView top() const noexcept {
+        assert(!packets.empty());
+        return packets.back();
+    }
+
+    void pop() noexcept {
+        assert(!packets.empty());
+        const auto &packet = packets.back();
+        auto &chunk = chunks[currentChunk];
+        if (packet.data + packet.size == chunk.data.get() + chunk.used) {
+            chunk.used -= packet.size;
+        }
+        packets.pop_back();
+    }
+
+    // Drops all packets and keeps the chunks for reuse.
+    void clear() noexcept {
+        packets.clear();
+        for (auto &chunk: chunks) {
+            chunk.used = 0;
+        }
+        currentChunk = 0;
+    }
+
+    // Drops all packets and frees the chunks.
+    void release() noexcept {
+        packets.clear();
+        chunks.clear();
+        currentChunk = 0;
+    }
+
+    [[nodiscard]] std::size_t capacity() const noexcept {
+        std::size_t bytes = 0;
+        for (const auto &chunk: chunks) {
+            bytes += chunk.capacity;
+        }
+        return bytes;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<Byte[]> data;
+        std::size_t capacity;
+        std::size_t used;
+    };
+
+    Byte *allocate(std::size_t size) {
+        if (chunks.empty() || chunks[currentChunk].capacity - chunks[currentChunk].used < size) {
+            nextChunk(size);
+        }
+        auto &chunk = chunks[currentChunk];
+        auto *ptr = chunk.data.get() + chunk.used;
+        chunk.used += size;
+        return ptr;
+    }
+
+    void nextChunk(std::size_t size) {
+        const std::size_t next = chunks.empty() ? 0 : currentChunk + 1;
+        if (next == chunks.size() || chunks[next].capacity < size) {
+            // a packet bigger than chunkSize gets a chunk of its own
+            const std::size_t capacity = std::max(chunkSize, size);
+            chunks.insert(chunks.begin() + next, Chunk{std::make_unique_for_overwrite<Byte[]>(capacity), capacity, 0});
+        }
+        currentChunk = next;
+    }
+
+    std::size_t chunkSize;
+    std::vector<Chunk> chunks;
+    std::size_t currentChunk = 0;
+    std::vector<PacketView> packets;
+};
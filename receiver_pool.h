@@ -0,0 +1,162 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+#include "spsc_ring.h"
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using StreamId = std::uint64_t;
+
+// Terminates many streams on a fixed set of shards, one thread per core. A stream always maps to
+// the same shard, which owns its Receiver, reassembly buffer and callback, so the parse path shares
+// no state between threads. Receive and Close copy the chunk into the shard's SpscRing and must be
+// called from a single dispatching thread; it waits while the shard is behind. Every stream's
+// receiver gets config; stats and a buffer pool in it are shared by the shard threads, which both
+// allow.
+struct ReceiverPool {
+    // Called on the shard thread when a stream sends its first chunk.
+    using CallbackFactory = std::function<std::shared_ptr<ICallback>(StreamId stream)>;
+
+    explicit ReceiverPool(CallbackFactory factory_,
+                          std::size_t shardCount = std::max(1u, std::thread::hardware_concurrency()),
+                          std::size_t queueCapacity = 1 << 20,
+                          ReceiverConfig config_ = {})
+            : factory(std::move(factory_)),
+              config(config_) {
+        shards.reserve(shardCount);
+        for (std::size_t i = 0; i < shardCount; ++i) {
+            shards.push_back(std::make_unique<Shard>(queueCapacity));
+        }
+        for (std::size_t i = 0; i < shardCount; ++i) {
+            auto &shard = *shards[i];
+            shard.thread = std::thread([this, &shard] { consume(shard); });
+            pinToCore(shard.thread, i);
+        }
+    }
+
+    // Parses what is queued, then stops the shards.
+    ~ReceiverPool() {
+        for (auto &shard: shards) {
+            push(*shard, RecordKind::Stop, 0, nullptr, 0);
+        }
+        for (auto &shard: shards) {
+            shard->thread.join();
+        }
+    }
+
+    ReceiverPool(const ReceiverPool &pool) = delete;
+
+    ReceiverPool &operator=(const ReceiverPool &pool) = delete;
+
+    void Receive(StreamId stream, const Byte *data, std::size_t size) {
+        auto &shard = *shards[shardOf(stream)];
+        // chunks bigger than a record are queued in pieces, the receiver doesn't care
+        const std::size_t maxChunk = shard.queue.maxRecordSize() - RECORD_HEADER_SIZE;
+        while (size > 0) {
+            const auto count = std::min(size, maxChunk);
+            push(shard, RecordKind::Data, stream, data, count);
+            data += count;
+            size -= count;
+        }
+    }
+
+    // Drops the state of a finished stream, including a partial packet.
+    void Close(StreamId stream) {
+        push(*shards[shardOf(stream)], RecordKind::Close, stream, nullptr, 0);
+    }
+
+    [[nodiscard]] std::size_t shardOf(StreamId stream) const noexcept {
+        return stream % shards.size();
+    }
+
+    [[nodiscard]] std::size_t shardCount() const noexcept {
+        return shards.size();
+    }
+
+private:
+    enum class RecordKind : Byte {
+        Data,
+        Close,
+        Stop,
+    };
+
+    // kind and stream id before the chunk
+    static constexpr std::size_t RECORD_HEADER_SIZE = 1 + sizeof(StreamId);
+
+    struct Shard {
+        explicit Shard(std::size_t queueCapacity)
+                : queue(queueCapacity) {
+        }
+
+        SpscRing queue;
+        // touched by the shard thread only
+        std::unordered_map<StreamId, std::unique_ptr<Receiver>> receivers;
+        std::thread thread;
+    };
+
+    static void pinToCore(std::thread &thread, std::size_t index) noexcept {
+#if defined(__linux__)
+        const auto cores = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % cores, &set);
+        // best effort, the shard works unpinned as well
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+    }
+
+    static void push(Shard &shard, RecordKind kind, StreamId stream, const Byte *data, std::size_t size) {
+        Byte *ptr;
+        while ((ptr = shard.queue.tryReserve(RECORD_HEADER_SIZE + size)) == nullptr) {
+            shard.queue.waitForRoom();
+        }
+        ptr[0] = static_cast<Byte>(kind);
+        std::memcpy(ptr + 1, &stream, sizeof(stream));
+        if (size > 0) {
+            std::memcpy(ptr + RECORD_HEADER_SIZE, data, size);
+        }
+        shard.queue.commit();
+    }
+
+    void consume(Shard &shard) {
+        while (true) {
+            const auto record = shard.queue.front();
+            if (record.empty()) {
+                shard.queue.waitForRecord();
+                continue;
+            }
+            const auto kind = static_cast<RecordKind>(record[0]);
+            StreamId stream;
+            std::memcpy(&stream, record.data() + 1, sizeof(stream));
+            if (kind == RecordKind::Stop) {
+                shard.queue.pop();
+                break;
+            }
+            if (kind == RecordKind::Close) {
+                shard.receivers.erase(stream);
+            } else {
+                auto &receiver = shard.receivers[stream];
+                if (!receiver) {
+                    receiver = std::make_unique<Receiver>(factory(stream), config);
+                }
+                receiver->Receive(record.data() + RECORD_HEADER_SIZE, record.size() - RECORD_HEADER_SIZE);
+            }
+            shard.queue.pop();
+        }
+        shard.receivers.clear();
+    }
+
+    CallbackFactory factory;
+    const ReceiverConfig config;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+// Fixed here instead of std::hardware_destructive_interference_size, which isn't stable across
+// compiler flags and would make the layout of the types below depend on them.
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// Log-linear histogram in the manner of HdrHistogram: every power of two is split in SUB_BUCKETS
+// buckets, so a recorded value is known to 1/SUB_BUCKETS of itself over the whole 64-bit range.
+// Recording is a relaxed increment; a monitoring thread reads without locks and gets counts that
+// are each exact but not necessarily from the same instant.
+struct Histogram {
+    static constexpr unsigned SUB_BUCKET_BITS = 3;
+    static constexpr std::size_t SUB_BUCKETS = std::size_t{1} << SUB_BUCKET_BITS;
+    static constexpr std::size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    Histogram() = default;
+
+    Histogram(const Histogram &histogram) = delete;
+
+    Histogram &operator=(const Histogram &histogram) = delete;
+
+    void record(std::uint64_t value) noexcept {
+        counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t count() const noexcept {
+        std::uint64_t total = 0;
+        for (const auto &bucket: counts) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Upper bound of the bucket holding the value at percentile (0 to 100), 0 when empty.
+    [[nodiscard]] std::uint64_t percentile(double percentile) const noexcept {
+        const auto total = count();
+        if (total == 0) {
+            return 0;
+        }
+        const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(percentile / 100 * total + 0.5));
+        std::uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+            seen += counts[bucket].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return highestOf(bucket);
+            }
+        }
+        return highestOf(BUCKETS - 1);
+    }
+
+    [[nodiscard]] std::uint64_t max() const noexcept {
+        return percentile(100);
+    }
+
+    static constexpr std::size_t bucketOf(std::uint64_t value) noexcept {
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+        const unsigned shift = std::bit_width(value) - 1 - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    static constexpr std::uint64_t lowestOf(std::size_t bucket) noexcept {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        const unsigned shift = bucket / SUB_BUCKETS - 1;
+        return (bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    }
+
+    static constexpr std::uint64_t highestOf(std::size_t bucket) noexcept {
+        return bucket + 1 < BUCKETS ? lowestOf(bucket + 1) - 1 : ~std::uint64_t{0};
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, BUCKETS> counts{};
+};
+
+struct ReceiveCounts {
+    std::uint64_t receiveCalls = 0;
+    std::uint64_t binaryPackets = 0;
+    std::uint64_t binaryBytes = 0;
+    std::uint64_t textPackets = 0;
+    std::uint64_t textBytes = 0;
+    // packets completed in the reassembly buffer instead of in the caller's memory
+    std::uint64_t reassembledPackets = 0;
+    // calls which ended with a partial frame in the buffer
+    std::uint64_t partialFrames = 0;
+    std::uint64_t droppedFrames = 0;
+};
+
+// What receivers attached to it through ReceiverConfig::stats did. A receiver counts in plain
+// fields and adds to these once per Receive call, so a stats object per receiver thread costs a
+// handful of uncontended relaxed additions per call. Readable from any thread without locks.
+struct ReceiverStats {
+    // Callback latencies are measured only if measureLatency is set, it takes two clock reads per
+    // handler call.
+    explicit ReceiverStats(bool measureLatency_ = false)
+            : measureLatency(measureLatency_) {
+    }
+
+    ReceiverStats(const ReceiverStats &stats) = delete;
+
+    ReceiverStats &operator=(const ReceiverStats &stats) = delete;
+
+    void add(const ReceiveCounts &counts, std::size_t bufferedBytes) noexcept {
+        add(totals.receiveCalls, counts.receiveCalls);
+        add(totals.binaryPackets, counts.binaryPackets);
+        add(totals.binaryBytes, counts.binaryBytes);
+        add(totals.textPackets, counts.textPackets);
+        add(totals.textBytes, counts.textBytes);
+        add(totals.reassembledPackets, counts.reassembledPackets);
+        add(totals.partialFrames, counts.partialFrames);
+        add(totals.droppedFrames, counts.droppedFrames);
+        if (bufferedBytes > 0) {
+            bufferDepth.record(bufferedBytes);
+        }
+    }
+
+    [[nodiscard]] bool measuresLatency() const noexcept {
+        return measureLatency;
+    }
+
+    void recordLatency(std::chrono::nanoseconds latency) noexcept {
+        callbackLatency.record(latency.count());
+    }
+
+    [[nodiscard]] ReceiveCounts counts() const noexcept {
+        return {
+                load(totals.receiveCalls), load(totals.binaryPackets), load(totals.binaryBytes),
+                load(totals.textPackets), load(totals.textBytes), load(totals.reassembledPackets),
+                load(totals.partialFrames), load(totals.droppedFrames),
+        };
+    }
+
+    // nanoseconds per handler call
+    [[nodiscard]] const Histogram &latency() const noexcept {
+        return callbackLatency;
+    }
+
+    // bytes left in the reassembly buffer by calls which left any
+    [[nodiscard]] const Histogram &depth() const noexcept {
+        return bufferDepth;
+    }
+
+private:
+    static void add(std::atomic<std::uint64_t> &counter, std::uint64_t value) noexcept {
+        if (value > 0) {
+            counter.fetch_add(value, std::memory_order_relaxed);
+        }
+    }
+
+    static std::uint64_t load(const std::atomic<std::uint64_t> &counter) noexcept {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    const bool measureLatency;
+    // written together, kept off the cache lines of whatever is allocated next to the stats
+    struct alignas(CACHE_LINE_SIZE) {
+        std::atomic<std::uint64_t> receiveCalls = 0;
+        std::atomic<std::uint64_t> binaryPackets = 0;
+        std::atomic<std::uint64_t> binaryBytes = 0;
+        std::atomic<std::uint64_t> textPackets = 0;
+        std::atomic<std::uint64_t> textBytes = 0;
+        std::atomic<std::uint64_t> reassembledPackets = 0;
+        std::atomic<std::uint64_t> partialFrames = 0;
+        std::atomic<std::uint64_t> droppedFrames = 0;
+    } totals;
+    alignas(CACHE_LINE_SIZE) Histogram callbackLatency;
+    alignas(CACHE_LINE_SIZE) Histogram bufferDepth;
+};
@@ -0,0 +1,283 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+
+#include <algorithm>
+#include <execution>
+#include <functional>
+#include <numeric>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only mapping of a whole capture file.
+struct MappedFile {
+    MappedFile() = default;
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile &file) = delete;
+
+    MappedFile &operator=(const MappedFile &file) = delete;
+
+    // Maps the file at path for one sequential pass, asking for huge pages too if hugePages is set
+    // (best effort, the kernel may not back file pages with them). False on failure, errno tells why.
+    bool open(const char *path, bool hugePages = false) {
+        close();
+        const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat status{};
+        if (::fstat(fd, &status) != 0) {
+            ::close(fd);
+            return false;
+        }
+        mappedSize = status.st_size;
+        if (mappedSize > 0) {
+            void *ptr = ::mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED) {
+                ::close(fd);
+                mappedSize = 0;
+                return false;
+            }
+            mapped = static_cast<const Byte *>(ptr);
+            // read ahead aggressively and drop pages behind
+            ::madvise(ptr, mappedSize, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+            if (hugePages) {
+                ::madvise(ptr, mappedSize, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        // the mapping stays valid without the descriptor
+        ::close(fd);
+        return true;
+    }
+
+    void close() noexcept {
+        if (mapped != nullptr) {
+            ::munmap(const_cast<Byte *>(mapped), mappedSize);
+        }
+        mapped = nullptr;
+        mappedSize = 0;
+    }
+
+    [[nodiscard]] const Byte *data() const noexcept {
+        return mapped;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return mappedSize;
+    }
+
+private:
+    const Byte *mapped = nullptr;
+    std::size_t mappedSize = 0;
+};
+
+// Frames with a binary header, compressed ones if the capture's receivers have a codec.
+inline bool hasBinaryHeader(const Byte *frame, const ReceiverConfig &config) noexcept {
+    return *frame == START_BYTE_BINARY_BLOCK || (*frame == START_BYTE_COMPRESSED_BLOCK && config.codec != nullptr);
+}
+
+// bytes after the payload of a frame with a binary header
+inline std::size_t trailerSize(const ReceiverConfig &config) noexcept {
+    return config.checksums ? CHECKSUM_SIZE : 0;
+}
+
+// End of the frame at ptr, or nullptr if it isn't complete before last. config is that of the
+// receivers the capture is meant for, it tells how frames are framed. Checksums aren't verified.
+inline const Byte *nextFrame(const Byte *ptr, const Byte *last, const ReceiverConfig &config = {}) noexcept {
+    if (hasBinaryHeader(ptr, config)) {
+        if (static_cast<std::size_t>(last - ptr) < BINARY_HEADER_SIZE) {
+            return nullptr;
+        }
+        const std::size_t frameSize = BINARY_HEADER_SIZE + decodeBinSize(ptr + sizeof(START_BYTE_BINARY_BLOCK)) +
+                                      trailerSize(config);
+        if (frameSize > static_cast<std::size_t>(last - ptr)) {
+            return nullptr;
+        }
+        return ptr + frameSize;
+    }
+    const auto *end = findTextEnding(ptr, last);
+    return end == last ? nullptr : end + ENDING_TEXT_BLOCK.size();
+}
+
+// Splits a capture into at most parts ranges of about the same size which start at frame
+// boundaries. Binary frames are stepped over by their header, only text is scanned. Whatever
+// follows the last complete frame goes to the last range.
+inline std::vector<std::span<const Byte>> splitAtFrames(const Byte *data, std::size_t size, std::size_t parts,
+                                                        const ReceiverConfig &config = {}) {
+    std::vector<std::span<const Byte>> ranges;
+    const auto *last = data + size;
+    const std::size_t target = size / std::max<std::size_t>(parts, 1) + 1;
+    const auto *start = data;
+    const auto *ptr = data;
+    while (ptr < last) {
+        const auto *end = nextFrame(ptr, last, config);
+        if (end == nullptr) {
+            break;
+        }
+        ptr = end;
+        if (static_cast<std::size_t>(ptr - start) >= target && ranges.size() + 1 < parts) {
+            ranges.emplace_back(start, ptr);
+            start = ptr;
+        }
+    }
+    if (start < last || ranges.empty()) {
+        ranges.emplace_back(start, last);
+    }
+    return ranges;
+}
+
+// Parses a whole capture in a single Receive call, straight from the mapping.
+template<typename ReceiverType>
+void replay(const MappedFile &file, ReceiverType &receiver) {
+    receiver.Receive(file.data(), file.size());
+}
+
+// Parses a capture on up to parts threads, the ranges of splitAtFrames in parallel. Packets arrive
+// in order within a range. makeReceiver(index) returns an owning pointer to the receiver of range
+// index; it is called, and the receiver released, on the thread of the range. config is that of
+// the receivers.
+template<typename Factory>
+void parallelReplay(const MappedFile &file, std::size_t parts, Factory &&makeReceiver,
+                    const ReceiverConfig &config = {}) {
+    const auto ranges = splitAtFrames(file.data(), file.size(), parts, config);
+    std::vector<std::thread> threads;
+    threads.reserve(ranges.size());
+    for (std::size_t i = 0; i < ranges.size(); ++i) {
+        threads.emplace_back([&makeReceiver, range = ranges[i], i] {
+            auto receiver = makeReceiver(i);
+            receiver->Receive(range.data(), range.size());
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
+
+// Frames of a buffer in struct-of-arrays form, so a pass over one field touches only its array.
+struct FrameIndex {
+    // start of the payload or text in the buffer
+    std::vector<std::uint64_t> offsets;
+    // payload or text bytes
+    std::vector<std::uint64_t> sizes;
+    std::vector<PacketType> types;
+    // 1 for compressed frames, whose offset and size are those of the whole compressed payload,
+    // and whose type is that of the packet they decompress to
+    std::vector<Byte> compressed;
+    // bytes covered by the indexed frames, the rest of the buffer is an incomplete frame
+    std::size_t indexedBytes = 0;
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return offsets.size();
+    }
+
+    [[nodiscard]] PacketView view(const Byte *data, std::size_t frame) const noexcept {
+        return {types[frame], data + offsets[frame], static_cast<std::size_t>(sizes[frame])};
+    }
+};
+
+// Phase one of a bulk decode: finds the frames of [data, data + size), framed as config says.
+// Frames form a chain, so this is one pass, but only text is scanned (with the SIMD scanner);
+// binary frames are stepped over by their header. No limits apply, the buffer is trusted.
+inline FrameIndex indexFrames(const Byte *data, std::size_t size, const ReceiverConfig &config = {}) {
+    FrameIndex index;
+    const auto *last = data + size;
+    const auto *ptr = data;
+    while (ptr < last) {
+        const auto *end = nextFrame(ptr, last, config);
+        if (end == nullptr) {
+            break;
+        }
+        if (!hasBinaryHeader(ptr, config)) {
+            index.offsets.push_back(ptr - data);
+            index.sizes.push_back(end - ptr - ENDING_TEXT_BLOCK.size());
+            index.types.push_back(PacketType::Text);
+            index.compressed.push_back(0);
+            ptr = end;
+            continue;
+        }
+        // the trailer isn't part of the payload
+        const auto *payloadEnd = end - trailerSize(config);
+        const auto frameSize = static_cast<std::size_t>(payloadEnd - ptr);
+        if (*ptr == START_BYTE_COMPRESSED_BLOCK && frameSize >= BINARY_HEADER_SIZE + COMPRESSED_HEADER_SIZE) {
+            const auto *payload = ptr + BINARY_HEADER_SIZE;
+            index.offsets.push_back(payload - data);
+            index.sizes.push_back(payloadEnd - payload);
+            index.types.push_back(payload[0] == static_cast<Byte>(PacketType::Text) ? PacketType::Text
+                                                                                   : PacketType::Binary);
+            index.compressed.push_back(1);
+        } else if (*ptr == START_BYTE_BINARY_BLOCK) {
+            index.offsets.push_back(ptr + BINARY_HEADER_SIZE - data);
+            index.sizes.push_back(payloadEnd - ptr - BINARY_HEADER_SIZE);
+            index.types.push_back(PacketType::Binary);
+            index.compressed.push_back(0);
+        }
+        ptr = end;
+    }
+    index.indexedBytes = ptr - data;
+    return index;
+}
+
+// Phase two: hands the indexed packets to function(part, packets) in batches, the frames split in
+// parts ranges processed in parallel. Batches of a part come in order on one thread; use part to
+// pick per-thread state. Compressed frames are decompressed with codec, which an index holding
+// them needs, and go in a batch of their own.
+template<typename Function>
+void decodeFrames(const Byte *data, const FrameIndex &index, std::size_t parts, Function &&function,
+                  const ICodec *codec = nullptr) {
+    static constexpr std::size_t BATCH_SIZE = 256;
+    parts = std::clamp<std::size_t>(parts, 1, std::max<std::size_t>(index.size(), 1));
+    std::vector<std::size_t> partIndexes(parts);
+    std::iota(partIndexes.begin(), partIndexes.end(), 0);
+    std::for_each(std::execution::par, partIndexes.begin(), partIndexes.end(),
+                  [data, &index, parts, &function, codec](std::size_t part) {
+                      const std::size_t first = index.size() * part / parts;
+                      const std::size_t last = index.size() * (part + 1) / parts;
+                      std::array<PacketView, BATCH_SIZE> batch;
+                      std::size_t count = 0;
+                      std::unique_ptr<Byte[]> inflated;
+                      std::size_t inflatedSize = 0;
+                      for (std::size_t frame = first; frame < last; ++frame) {
+                          if (!index.compressed[frame]) {
+                              batch[count++] = index.view(data, frame);
+                              if (count == BATCH_SIZE) {
+                                  function(part, std::span<const PacketView>(batch.data(), count));
+                                  count = 0;
+                              }
+                              continue;
+                          }
+                          assert(codec != nullptr);
+                          if (count > 0) {
+                              function(part, std::span<const PacketView>(batch.data(), count));
+                              count = 0;
+                          }
+                          const auto *payload = data + index.offsets[frame];
+                          const std::size_t originalSize = decodeBinSize(payload + 1);
+                          if (inflatedSize < originalSize) {
+                              inflated = std::make_unique_for_overwrite<Byte[]>(originalSize);
+                              inflatedSize = originalSize;
+                          }
+                          if (codec->decompress(payload + COMPRESSED_HEADER_SIZE,
+                                                index.sizes[frame] - COMPRESSED_HEADER_SIZE,
+                                                inflated.get(), originalSize)) {
+                              const PacketView packet{index.types[frame], inflated.get(), originalSize};
+                              function(part, std::span<const PacketView>(&packet, 1));
+                          }
+                      }
+                      if (count > 0) {
+                          function(part, std::span<const PacketView>(batch.data(), count));
+                      }
+                  });
+}
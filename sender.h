@@ -0,0 +1,281 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+
+#include <cerrno>
+#include <chrono>
+#include <span>
+#include <tuple>
+#include <vector>
+
+#include <sys/uio.h>
+
+struct ISender {
+    virtual ~ISender() = default;
+
+    // Sends the bytes of buffers in order, returns how many were sent.
+    virtual std::size_t Send(std::span<const iovec> buffers) = 0;
+};
+
+// Encodes tuples like pack, but as a list of iovecs instead of one contiguous block. Headers,
+// terminators and small payloads are copied to a scratch arena, payloads of referenceLimit bytes
+// and more are referenced in place. The iovecs are valid until the next encode, and only while the
+// encoded tuple and the strings it points to are alive. With checksums binary blocks get the
+// CRC32C trailer of ReceiverConfig::checksums. Throws like packTo.
+struct GatherEncoder {
+    explicit GatherEncoder(std::size_t referenceLimit_ = 256, bool checksums_ = false)
+            : referenceLimit(referenceLimit_),
+              checksums(checksums_) {
+    }
+
+    GatherEncoder(const GatherEncoder &encoder) = delete;
+
+    GatherEncoder &operator=(const GatherEncoder &encoder) = delete;
+
+    template<typename ...Ts>
+    std::span<const iovec> encode(const std::tuple<Ts...> &values) {
+        const auto layout = packLayout(values);
+        checkPayloadSizes(layout);
+        encodedSize = layout.size;
+        iovecs.clear();
+        const std::size_t trailerSize = checksums ? CHECKSUM_SIZE : 0;
+        // sized up front, the arena must not reallocate while iovecs point into it
+        std::size_t arenaSize = 0;
+        forEachValue(values, layout, [this, &arenaSize, trailerSize](const auto &value, std::size_t length) {
+            if constexpr (IS_TEXT_VALUE<decltype(value)>) {
+                arenaSize += ENDING_TEXT_BLOCK.size();
+            } else {
+                arenaSize += BINARY_HEADER_SIZE + trailerSize;
+                encodedSize += trailerSize;
+            }
+            if (length < referenceLimit) {
+                arenaSize += length;
+            }
+        });
+        arena.resize(arenaSize);
+        arenaPos = 0;
+        forEachValue(values, layout, [this](const auto &value, std::size_t length) {
+            if constexpr (IS_TEXT_VALUE<decltype(value)>) {
+                appendPayload(reinterpret_cast<const Byte *>(value), length);
+                appendCopy(ENDING_TEXT_BLOCK.data(), ENDING_TEXT_BLOCK.size());
+            } else {
+                std::array<Byte, BINARY_HEADER_SIZE> header{};
+                packBinaryHeader(length, header.data());
+                appendCopy(header.data(), header.size());
+                appendPayload(payloadBytes(value), length);
+                if (checksums) {
+                    // over the size field and the payload, like packChecksummedValue
+                    auto checksum = crc32cUpdate(CRC32C_INIT, header.data() + sizeof(START_BYTE_BINARY_BLOCK),
+                                                 sizeof(BinSize));
+                    checksum = crc32cUpdate(checksum, payloadBytes(value), length);
+                    const auto trailer = encodeBinSize(crc32cFinish(checksum));
+                    appendCopy(trailer.data(), trailer.size());
+                }
+            }
+        });
+        return iovecs;
+    }
+
+    // bytes described by the iovecs of the last encode
+    [[nodiscard]] std::size_t size() const noexcept {
+        return encodedSize;
+    }
+
+private:
+    template<typename ...Ts, typename Function>
+    static void forEachValue(const std::tuple<Ts...> &values, const PackLayout<Ts...> &layout, Function &&function) {
+        std::apply([&layout, &function](const auto &... args) {
+            std::size_t index = 0;
+            ((function(args, layout.lengths[index++])), ...);
+        }, values);
+    }
+
+    void appendPayload(const Byte *data, std::size_t size) {
+        if (size < referenceLimit) {
+            appendCopy(data, size);
+        } else {
+            append(data, size);
+        }
+    }
+
+    void appendCopy(const Byte *data, std::size_t size) {
+        auto *ptr = arena.data() + arenaPos;
+        std::copy(data, data + size, ptr);
+        arenaPos += size;
+        append(ptr, size);
+    }
+
+    void append(const Byte *data, std::size_t size) {
+        if (size == 0) {
+            return;
+        }
+        if (!iovecs.empty()) {
+            auto &last = iovecs.back();
+            if (static_cast<const Byte *>(last.iov_base) + last.iov_len == data) {
+                // consecutive arena copies end up in a single iovec
+                last.iov_len += size;
+                return;
+            }
+        }
+        iovecs.push_back({const_cast<Byte *>(data), size});
+    }
+
+    std::size_t referenceLimit;
+    bool checksums;
+    std::vector<Byte> arena;
+    std::size_t arenaPos = 0;
+    std::vector<iovec> iovecs;
+    std::size_t encodedSize = 0;
+};
+
+// Writes to a file descriptor (socket, pipe, file) with writev, not owning it.
+struct SocketSender : public ISender {
+    explicit SocketSender(int fd_)
+            : fd(fd_) {
+    }
+
+    SocketSender(const SocketSender &sender) = delete;
+
+    SocketSender &operator=(const SocketSender &sender) = delete;
+
+    // Stops early on an error other than EINTR, errno tells which.
+    std::size_t Send(std::span<const iovec> buffers) override {
+        // Linux UIO_MAXIOV
+        constexpr std::size_t MAX_IOVECS = 1024;
+        pending.assign(buffers.begin(), buffers.end());
+        std::size_t sent = 0;
+        std::size_t first = 0;
+        while (first < pending.size()) {
+            const auto count = static_cast<int>(std::min(pending.size() - first, MAX_IOVECS));
+            const auto result = ::writev(fd, pending.data() + first, count);
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            sent += result;
+            // short write, skip what went out
+            auto written = static_cast<std::size_t>(result);
+            while (first < pending.size() && written >= pending[first].iov_len) {
+                written -= pending[first].iov_len;
+                ++first;
+            }
+            if (written > 0) {
+                pending[first].iov_base = static_cast<Byte *>(pending[first].iov_base) + written;
+                pending[first].iov_len -= written;
+            }
+        }
+        return sent;
+    }
+
+private:
+    int fd;
+    std::vector<iovec> pending;
+};
+
+struct BatcherConfig {
+    // a batch of this many bytes goes out, it's also the size of the preallocated buffer
+    std::size_t maxBytes = 64 << 10;
+    std::size_t maxFrames = 64;
+    // and no frame waits longer than this, given add or poll is called
+    std::chrono::microseconds maxDelay{200};
+    // blocks are packed for a receiver with ReceiverConfig::checksums on
+    bool checksums = false;
+};
+
+// Coalesces packed blocks into one buffer and sends it with a single call once it holds maxBytes
+// or maxFrames, or its oldest block is maxDelay old. There is no timer: the deadline is checked by
+// add and poll, so an idle caller polls by deadline(). Blocks which don't fit in the buffer at all
+// go out on their own through a GatherEncoder, after the batch. The sender isn't owned.
+struct FrameBatcher {
+    explicit FrameBatcher(ISender &sender_, BatcherConfig config_ = {})
+            : sender(sender_),
+              config(config_),
+              buffer(config.maxBytes),
+              encoder(256, config.checksums) {
+    }
+
+    // sends what is left
+    ~FrameBatcher() {
+        flush();
+    }
+
+    FrameBatcher(const FrameBatcher &batcher) = delete;
+
+    FrameBatcher &operator=(const FrameBatcher &batcher) = delete;
+
+    // Queues the block of values. False if sending a batch failed, what wasn't sent is lost.
+    // Throws like packTo, before anything is sent.
+    template<typename ...Ts>
+    bool add(const std::tuple<Ts...> &values) {
+        bool sent = true;
+        auto result = packBlock(std::span(buffer).subspan(used), values);
+        if (!result.fits) {
+            // the queued frames stay queued if this one can't be framed
+            checkPayloadSizes(packLayout(values));
+            sent = flush();
+            result = packBlock(buffer, values);
+            if (!result.fits) {
+                const auto iovecs = encoder.encode(values);
+                return sender.Send(iovecs) == encoder.size() && sent;
+            }
+        }
+        if (frames == 0) {
+            oldest = std::chrono::steady_clock::now();
+        }
+        used += result.size;
+        ++frames;
+        if (used >= config.maxBytes || frames >= config.maxFrames) {
+            return flush() && sent;
+        }
+        return poll() && sent;
+    }
+
+    // Sends the batch if its deadline has passed.
+    bool poll() {
+        if (frames > 0 && std::chrono::steady_clock::now() >= deadline()) {
+            return flush();
+        }
+        return true;
+    }
+
+    // Sends the batch now, for blocks which shouldn't wait. False if not all of it was sent.
+    bool flush() {
+        if (frames == 0) {
+            return true;
+        }
+        const iovec batch{buffer.data(), used};
+        const bool sent = sender.Send({&batch, 1}) == used;
+        used = 0;
+        frames = 0;
+        return sent;
+    }
+
+    // when the queued blocks are due, meaningful while pendingFrames() > 0
+    [[nodiscard]] std::chrono::steady_clock::time_point deadline() const noexcept {
+        return oldest + config.maxDelay;
+    }
+
+    [[nodiscard]] std::size_t pendingFrames() const noexcept {
+        return frames;
+    }
+
+    [[nodiscard]] std::size_t pendingBytes() const noexcept {
+        return used;
+    }
+
+private:
+    template<typename ...Ts>
+    PackResult packBlock(std::span<Byte> out, const std::tuple<Ts...> &values) const noexcept {
+        return config.checksums ? packChecksummedInto(out, values) : packInto(out, values);
+    }
+
+    ISender &sender;
+    const BatcherConfig config;
+    std::vector<Byte> buffer;
+    std::size_t used = 0;
+    std::size_t frames = 0;
+    std::chrono::steady_clock::time_point oldest;
+    GatherEncoder encoder;
+};
@@ -0,0 +1,1806 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "receiver_stats.h"
+
+#include <iostream>
+#include <memory>
+#include <new>
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+#include <utility>
+#include <cassert>
+#include <array>
+#include <tuple>
+#include <iterator>
+#include <type_traits>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <bit>
+#include <span>
+#include <ranges>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+using Byte = uint8_t;
+
+constexpr Byte START_BYTE_BINARY_BLOCK = {0x24};
+constexpr auto ENDING_TEXT_BLOCK = std::array<Byte, 4 >{'\r', '\n', '\r', '\n'};
+// Binary payload size as it follows the start byte, in big-endian (network) byte order.
+using BinSize = std::uint32_t;
+constexpr size_t BINARY_HEADER_SIZE = sizeof(START_BYTE_BINARY_BLOCK) + sizeof(BinSize);
+// the largest payload a size field holds, encoders reject larger ones
+constexpr size_t MAX_PAYLOAD_SIZE = std::numeric_limits<BinSize>::max();
+// A compressed frame is framed like a binary one, its payload is the type of the original packet,
+// the original size as a BinSize and the compressed bytes. Receivers expect it only when given a
+// codec, then text may not start with this byte either.
+constexpr Byte START_BYTE_COMPRESSED_BLOCK = {0x25};
+constexpr size_t COMPRESSED_HEADER_SIZE = 1 + sizeof(BinSize);
+// With ReceiverConfig::checksums binary (and compressed) frames end with the CRC32C of their size
+// field and payload, big-endian.
+constexpr size_t CHECKSUM_SIZE = sizeof(std::uint32_t);
+
+constexpr std::uint32_t byteSwap32(std::uint32_t value) noexcept {
+#if defined(__cpp_lib_byteswap)
+    return std::byteswap(value);
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap32(value);
+#else
+    // recognized as bswap by MSVC as well
+    return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+#endif
+}
+
+constexpr BinSize toBigEndian(BinSize value) noexcept {
+    if constexpr (std::endian::native == std::endian::little) {
+        return byteSwap32(value);
+    } else {
+        return value;
+    }
+}
+
+// A single unaligned load and a byte swap on little-endian targets.
+constexpr BinSize decodeBinSize(const Byte *ptr) noexcept {
+    if (std::is_constant_evaluated()) {
+        return static_cast<BinSize>(ptr[0]) << 24 | static_cast<BinSize>(ptr[1]) << 16 |
+               static_cast<BinSize>(ptr[2]) << 8 | ptr[3];
+    }
+    BinSize value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return toBigEndian(value);
+}
+
+constexpr std::array<Byte, sizeof(BinSize)> encodeBinSize(BinSize size) noexcept {
+    return std::bit_cast<std::array<Byte, sizeof(BinSize)>>(toBigEndian(size));
+}
+
+inline unsigned countTrailingZeros(std::uint64_t mask) noexcept {
+    assert(mask != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return index;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+// Delimiter scanners. Each vector step compares 32 (AVX2) or 16 (SSE2, NEON) positions at once,
+// the remainder is handled by the scalar code. Both return last when nothing is found.
+inline const Byte *findByte(const Byte *first, const Byte *last, Byte value) noexcept {
+#if defined(__AVX2__)
+    const auto needle = _mm256_set1_epi8(static_cast<char>(value));
+    for (; last - first >= 32; first += 32) {
+        const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        const auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask != 0) {
+            return first + countTrailingZeros(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    const auto needle16 = _mm_set1_epi8(static_cast<char>(value));
+    for (; last - first >= 16; first += 16) {
+        const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        const auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle16)));
+        if (mask != 0) {
+            return first + countTrailingZeros(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const auto needle = vdupq_n_u8(value);
+    for (; last - first >= 16; first += 16) {
+        const auto eq = vceqq_u8(vld1q_u8(first), needle);
+        // 4 bits per byte
+        const auto mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask != 0) {
+            return first + countTrailingZeros(mask) / 4;
+        }
+    }
+#endif
+    return std::find(first, last, value);
+}
+
+inline const Byte *findTextEnding(const Byte *first, const Byte *last) noexcept {
+    constexpr auto lookahead = ENDING_TEXT_BLOCK.size() - 1;
+#if defined(__AVX2__)
+    const auto cr = _mm256_set1_epi8('\r');
+    const auto lf = _mm256_set1_epi8('\n');
+    for (; last - first >= static_cast<std::ptrdiff_t>(32 + lookahead); first += 32) {
+        const auto load = [first](std::size_t offset) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first + offset));
+        };
+        const auto eq = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(load(0), cr), _mm256_cmpeq_epi8(load(1), lf)),
+                _mm256_and_si256(_mm256_cmpeq_epi8(load(2), cr), _mm256_cmpeq_epi8(load(3), lf)));
+        const auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(eq));
+        if (mask != 0) {
+            return first + countTrailingZeros(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    const auto cr16 = _mm_set1_epi8('\r');
+    const auto lf16 = _mm_set1_epi8('\n');
+    for (; last - first >= static_cast<std::ptrdiff_t>(16 + lookahead); first += 16) {
+        const auto load = [first](std::size_t offset) {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i *>(first + offset));
+        };
+        const auto eq = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(load(0), cr16), _mm_cmpeq_epi8(load(1), lf16)),
+                _mm_and_si128(_mm_cmpeq_epi8(load(2), cr16), _mm_cmpeq_epi8(load(3), lf16)));
+        const auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(eq));
+        if (mask != 0) {
+            return first + countTrailingZeros(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const auto cr = vdupq_n_u8('\r');
+    const auto lf = vdupq_n_u8('\n');
+    for (; last - first >= static_cast<std::ptrdiff_t>(16 + lookahead); first += 16) {
+        const auto eq = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(first), cr), vceqq_u8(vld1q_u8(first + 1), lf)),
+                                 vandq_u8(vceqq_u8(vld1q_u8(first + 2), cr), vceqq_u8(vld1q_u8(first + 3), lf)));
+        const auto mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask != 0) {
+            return first + countTrailingZeros(mask) / 4;
+        }
+    }
+#endif
+    return std::search(first, last, std::begin(ENDING_TEXT_BLOCK), std::end(ENDING_TEXT_BLOCK));
+}
+
+// CRC32C (Castagnoli). Chain crc32cUpdate over consecutive pieces starting with CRC32C_INIT and
+// finish with crc32cFinish. Uses the SSE4.2 CRC instruction on x86-64 CPUs which have it, checked
+// once at run time unless compiled for SSE4.2; the ARMv8 ones when compiled for them; slicing-by-8
+// tables otherwise.
+constexpr std::uint32_t CRC32C_INIT = 0xFFFFFFFF;
+
+constexpr auto CRC32C_TABLES = [] {
+    // tables[k][i]: CRC of byte i followed by k zero bytes
+    std::array<std::array<std::uint32_t, 256>, 8> tables{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        std::uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0x82F63B78 & (0u - (crc & 1)));
+        }
+        tables[0][i] = crc;
+    }
+    for (std::size_t k = 1; k < tables.size(); ++k) {
+        for (std::size_t i = 0; i < 256; ++i) {
+            tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+        }
+    }
+    return tables;
+}();
+
+// slicing-by-8, on any target
+inline std::uint32_t crc32cUpdateTables(std::uint32_t crc, const Byte *data, std::size_t size) noexcept {
+    const auto &tables = CRC32C_TABLES;
+    for (; size >= 8; data += 8, size -= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        if constexpr (std::endian::native == std::endian::big) {
+            word = (std::uint64_t{byteSwap32(static_cast<std::uint32_t>(word))} << 32) | byteSwap32(word >> 32);
+        }
+        word ^= crc;
+        crc = tables[7][word & 0xFF] ^ tables[6][(word >> 8) & 0xFF] ^ tables[5][(word >> 16) & 0xFF] ^
+              tables[4][(word >> 24) & 0xFF] ^ tables[3][(word >> 32) & 0xFF] ^ tables[2][(word >> 40) & 0xFF] ^
+              tables[1][(word >> 48) & 0xFF] ^ tables[0][word >> 56];
+    }
+    for (; size > 0; ++data, --size) {
+        crc = tables[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_HARDWARE 1
+// Compiled for SSE4.2 whatever the target, called only where the CPU has it.
+__attribute__((target("sse4.2")))
+inline std::uint32_t crc32cUpdateHardware(std::uint32_t crc, const Byte *data, std::size_t size) noexcept {
+    for (; size >= 8; data += 8, size -= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = static_cast<std::uint32_t>(_mm_crc32_u64(crc, word));
+    }
+    for (; size > 0; ++data, --size) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+inline bool hasCrc32cInstructions() noexcept {
+#if defined(__SSE4_2__)
+    return true;
+#else
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+#endif
+}
+#elif defined(__ARM_FEATURE_CRC32) && defined(__ARM_ARCH_ISA_A64)
+#define CRC32C_HARDWARE 1
+inline std::uint32_t crc32cUpdateHardware(std::uint32_t crc, const Byte *data, std::size_t size) noexcept {
+    for (; size >= 8; data += 8, size -= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; ++data, --size) {
+        crc = __crc32cb(crc, *data);
+    }
+    return crc;
+}
+
+// only compiled in when the target has them
+inline bool hasCrc32cInstructions() noexcept {
+    return true;
+}
+#endif
+
+inline std::uint32_t crc32cUpdate(std::uint32_t crc, const Byte *data, std::size_t size) noexcept {
+#if defined(CRC32C_HARDWARE)
+    if (hasCrc32cInstructions()) {
+        return crc32cUpdateHardware(crc, data, size);
+    }
+#endif
+    return crc32cUpdateTables(crc, data, size);
+}
+
+constexpr std::uint32_t crc32cFinish(std::uint32_t crc) noexcept {
+    return ~crc;
+}
+
+inline std::uint32_t crc32c(const Byte *data, std::size_t size) noexcept {
+    return crc32cFinish(crc32cUpdate(CRC32C_INIT, data, size));
+}
+
+struct HexDump {
+    const Byte *data;
+    std::size_t size;
+};
+
+inline std::ostream &operator<<(std::ostream &out, HexDump dump) {
+    out << "==== Block byte size " << dump.size << " bytes ====" << '\n';
+    for (int i = 0; i < 16; ++i) {
+        out << std::setfill('0') << std::setw(2) << std::uppercase << std::hex << i << "|" << std::dec;
+    }
+    out << '\n';
+    size_t pos = 0;
+    while (pos < dump.size) {
+        const auto length = std::min(16, (int) (dump.size - pos));
+        for (int i = 0; i < length; ++i) {
+            out << std::setfill('0') << std::setw(2)
+                << std::uppercase << std::hex << static_cast<int>(dump.data[pos + i]) << "|" << std::dec;
+        }
+        out << '\n';
+        pos += length;
+    }
+    return out;
+}
+
+inline void print(const Byte *ptr, std::size_t size) noexcept {
+    std::cout << HexDump{ptr, size} << std::flush;
+}
+
+enum class TraceLevel {
+    Off,
+    // receiver lifetime events
+    Info,
+    // every Receive call and a hex dump of every packet
+    Debug,
+};
+
+// Most verbose level compiled in by default, 0 (Off) to 2 (Debug).
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL 0
+#endif
+
+// Tracers are called as tracer(level, func, args...). Tracer::level is the most verbose level a
+// tracer records; trace calls above it are discarded at compile time and their arguments are never
+// evaluated into output.
+struct NullTracer {
+    static constexpr TraceLevel level = TraceLevel::Off;
+
+    template<typename ...Args>
+    void operator()(TraceLevel, const char *, const Args &...) const noexcept {
+    }
+};
+
+template<TraceLevel Level>
+struct StreamTracer {
+    static constexpr TraceLevel level = Level;
+
+    template<typename ...Args>
+    void operator()(TraceLevel, const char *func, const Args &...args) const {
+        std::clog << func;
+        ((std::clog << args), ...);
+        std::clog << '\n';
+    }
+};
+
+using DefaultTracer = std::conditional_t<TRACE_LEVEL == 0,
+        NullTracer,
+        StreamTracer<static_cast<TraceLevel>(TRACE_LEVEL)>>;
+
+template<TraceLevel Level, typename Tracer, typename ...Args>
+inline void trace(const Tracer &tracer, const char *func, const Args &...args) {
+    if constexpr (Level != TraceLevel::Off && Level <= Tracer::level) {
+        tracer(Level, func, args...);
+    }
+}
+
+// Reassembly store for partial frames. Consumed bytes only advance the read
+// cursor, appends go to the write cursor. Unread bytes are moved to the front
+// lazily, only when the tail has no room left for an append. The storage comes
+// from pool if there is one, which may refuse it, else from new: appends fail
+// if it can't be had.
+struct ByteBuffer {
+    explicit ByteBuffer(BufferPool *pool_ = nullptr)
+            : pool(pool_) {
+    }
+
+    ~ByteBuffer() {
+        deallocate(storage, storageSize);
+    }
+
+    ByteBuffer(const ByteBuffer &buffer) = delete;
+
+    ByteBuffer &operator=(const ByteBuffer &buffer) = delete;
+
+    [[nodiscard]] bool empty() const noexcept {
+        return readPos == writePos;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return writePos - readPos;
+    }
+
+    [[nodiscard]] std::size_t capacity() const noexcept {
+        return storageSize;
+    }
+
+    [[nodiscard]] const Byte *data() const noexcept {
+        return storage + readPos;
+    }
+
+    // False, with nothing appended, if the pool has no room for the bytes.
+    [[nodiscard]] bool append(const Byte *ptr, std::size_t count) {
+        if (!reserveTail(count)) {
+            return false;
+        }
+        if (count > 0) {
+            std::memcpy(storage + writePos, ptr, count);
+        }
+        writePos += count;
+        return true;
+    }
+
+    // Room for up to count bytes at the write cursor, which become part of the buffer on commit.
+    // nullptr if the pool has no room for them.
+    [[nodiscard]] Byte *prepare(std::size_t count) {
+        return reserveTail(count) ? storage + writePos : nullptr;
+    }
+
+    void commit(std::size_t count) noexcept {
+        assert(count <= storageSize - writePos);
+        writePos += count;
+    }
+
+    void consume(std::size_t count) noexcept {
+        assert(count <= size());
+        readPos += count;
+        if (readPos == writePos) {
+            // nothing left, next append starts from the front without moving anything
+            readPos = writePos = 0;
+        }
+    }
+
+    void clear() noexcept {
+        readPos = writePos = 0;
+    }
+
+    // Gives the storage of an empty buffer back to the pool. Consumed bytes stay readable until
+    // then. Without a pool the storage is kept, like a vector's capacity.
+    void releaseIfEmpty() noexcept {
+        if (pool != nullptr && empty()) {
+            deallocate(storage, storageSize);
+            storage = nullptr;
+            storageSize = 0;
+        }
+    }
+
+    // Moves the unread bytes to the smallest storage which holds them, frees the storage if there
+    // are none. False if the smaller storage couldn't be had, the buffer is unchanged then.
+    bool shrinkToFit() {
+        const std::size_t used = size();
+        if (used == 0) {
+            deallocate(storage, storageSize);
+            storage = nullptr;
+            storageSize = 0;
+            clear();
+            return true;
+        }
+        std::size_t shrunkSize = 0;
+        auto *shrunk = allocate(used, shrunkSize);
+        if (shrunk == nullptr) {
+            return false;
+        }
+        if (shrunkSize >= storageSize) {
+            deallocate(shrunk, shrunkSize);
+            return true;
+        }
+        std::memcpy(shrunk, storage + readPos, used);
+        replace(shrunk, shrunkSize, used);
+        return true;
+    }
+
+private:
+    bool reserveTail(std::size_t count) {
+        if (storageSize - writePos >= count) {
+            return true;
+        }
+        const std::size_t used = size();
+        if (storageSize - used >= count) {
+            // compact: unread bytes to the front
+            std::memmove(storage, storage + readPos, used);
+            readPos = 0;
+            writePos = used;
+            return true;
+        }
+        std::size_t grownSize = 0;
+        const std::size_t needed = used + count;
+        auto *grown = allocate(std::max(storageSize * 2, needed), grownSize);
+        if (grown == nullptr && storageSize * 2 > needed) {
+            // there may still be room for what is needed without the headroom
+            grown = allocate(needed, grownSize);
+        }
+        if (grown == nullptr) {
+            return false;
+        }
+        if (used > 0) {
+            std::memcpy(grown, storage + readPos, used);
+        }
+        replace(grown, grownSize, used);
+        return true;
+    }
+
+    Byte *allocate(std::size_t size, std::size_t &allocatedSize) {
+        if (pool != nullptr) {
+            return pool->acquire(size, allocatedSize);
+        }
+        allocatedSize = size;
+        // like the pool's, a failed allocation fails the append instead of the Receive call
+        return new(std::nothrow) Byte[size];
+    }
+
+    void deallocate(Byte *block, std::size_t blockSize) noexcept {
+        if (block == nullptr) {
+            return;
+        }
+        if (pool != nullptr) {
+            pool->release(block, blockSize);
+        } else {
+            delete[] block;
+        }
+    }
+
+    void replace(Byte *block, std::size_t blockSize, std::size_t used) noexcept {
+        deallocate(storage, storageSize);
+        storage = block;
+        storageSize = blockSize;
+        readPos = 0;
+        writePos = used;
+    }
+
+    BufferPool *pool;
+    Byte *storage = nullptr;
+    std::size_t storageSize = 0;
+    std::size_t readPos = 0;
+    std::size_t writePos = 0;
+};
+
+// Search progress of a text packet whose terminator hasn't arrived yet.
+struct TextScan {
+    // bytes of the packet already examined
+    std::size_t scanned = 0;
+    // trailing bytes of the examined part which are a prefix of ENDING_TEXT_BLOCK
+    std::size_t matched = 0;
+};
+
+// Length of the longest suffix of [first, last) which is a proper prefix of ENDING_TEXT_BLOCK.
+inline std::size_t textEndingPrefixLength(const Byte *first, const Byte *last) noexcept {
+    for (std::size_t length = std::min<std::size_t>(ENDING_TEXT_BLOCK.size() - 1, last - first); length > 0; --length) {
+        if (std::equal(last - length, last, std::begin(ENDING_TEXT_BLOCK))) {
+            return length;
+        }
+    }
+    return 0;
+}
+
+// Continues the terminator search of a text packet at first, scan describes the packet bytes before
+// first. Returns the end of the terminator, or nullptr when it isn't in [first, last) yet, in which
+// case scan is extended to cover [first, last) so the next call can start at the following byte.
+inline const Byte *findTextEnding(const Byte *first, const Byte *last, TextScan &scan) noexcept {
+    if (scan.matched > 0) {
+        // a terminator may be split between calls. No proper suffix of a partial CRLFCRLF match that
+        // is itself a prefix of it can continue where the whole match fails, so on a mismatch the
+        // search simply goes on from first.
+        const std::size_t needed = ENDING_TEXT_BLOCK.size() - scan.matched;
+        const std::size_t available = std::min<std::size_t>(needed, last - first);
+        if (std::equal(first, first + available, std::begin(ENDING_TEXT_BLOCK) + scan.matched)) {
+            if (available == needed) {
+                return first + needed;
+            }
+            scan.scanned += available;
+            scan.matched += available;
+            return nullptr;
+        }
+    }
+    const auto *it = findTextEnding(first, last);
+    if (it == last) {
+        scan.scanned += last - first;
+        scan.matched = textEndingPrefixLength(first, last);
+        return nullptr;
+    }
+    return it + ENDING_TEXT_BLOCK.size();
+}
+
+struct IReceiver {
+    virtual ~IReceiver() = default;
+
+    virtual void Receive(const Byte *data, std::size_t size) = 0;
+};
+
+enum class PacketType : Byte {
+    Binary,
+    Text,
+};
+
+struct PacketView {
+    PacketType type;
+    const Byte *data;
+    std::size_t size;
+};
+
+// Reasons a frame is dropped, see ReceiverConfig.
+enum class FrameError {
+    BinaryTooLarge,
+    TextTooLong,
+    BufferLimit,
+    // a compressed frame which doesn't decompress to what its header says
+    BadCompressedFrame,
+    // a binary frame whose trailer doesn't match, see ReceiverConfig::checksums
+    BadChecksum,
+};
+
+// Compression of the payloads of compressed frames; both ends have to agree on the codec. Called
+// concurrently when shared between receivers on several threads.
+struct ICodec {
+    virtual ~ICodec() = default;
+
+    // the most compress writes for size bytes
+    [[nodiscard]] virtual std::size_t maxCompressedSize(std::size_t size) const = 0;
+
+    // Returns the compressed size, 0 on failure.
+    virtual std::size_t compress(const Byte *data, std::size_t size, Byte *out, std::size_t capacity) const = 0;
+
+    // Decompresses to exactly originalSize bytes at out, false if the data doesn't.
+    virtual bool decompress(const Byte *data, std::size_t size, Byte *out, std::size_t originalSize) const = 0;
+};
+
+struct ICallback {
+    virtual ~ICallback() = default;
+
+    virtual void BinaryPacket(const Byte *data, std::size_t size) = 0;
+
+    virtual void TextPacket(const Byte *data, std::size_t size) = 0;
+
+    // Receives all packets parsed by one Receive call. The views are valid until it returns.
+    // The default implementation forwards each packet to BinaryPacket or TextPacket.
+    virtual void Packets(std::span<const PacketView> packets) {
+        for (const auto &packet: packets) {
+            if (packet.type == PacketType::Binary) {
+                BinaryPacket(packet.data, packet.size);
+            } else {
+                TextPacket(packet.data, packet.size);
+            }
+        }
+    }
+
+    // Called when a frame is dropped, after the packets which preceded it.
+    virtual void InvalidFrame(FrameError /*error*/) {
+    }
+
+    // Binary payloads of ReceiverConfig::streamBinaryFrom bytes and more are delivered in order,
+    // as they arrive, by these instead of BinaryPacket. Override them when enabling streaming.
+    virtual void BinaryBegin(std::size_t /*size*/) {
+    }
+
+    virtual void BinaryChunk(const Byte * /*data*/, std::size_t /*size*/) {
+    }
+
+    virtual void BinaryEnd() {
+    }
+
+    // Text which reaches ReceiverConfig::streamTextFrom bytes before its terminator arrives is
+    // delivered in order by these instead of TextPacket. Override them when enabling streaming.
+    virtual void TextBegin() {
+    }
+
+    virtual void TextChunk(const Byte * /*data*/, std::size_t /*size*/) {
+    }
+
+    virtual void TextEnd() {
+    }
+};
+
+
+// Handlers with a Packets member get the packets of a Receive call in batches of up to
+// MAX_BATCH_PACKETS, others get a BinaryPacket/TextPacket call per packet.
+constexpr std::size_t MAX_BATCH_PACKETS = 1024;
+
+template<typename Handler>
+concept BatchHandler = requires(Handler &handler, std::span<const PacketView> packets) {
+    handler.Packets(packets);
+};
+
+// Handlers with an InvalidFrame member are told about dropped frames.
+template<typename Handler>
+concept FrameErrorHandler = requires(Handler &handler, FrameError error) {
+    handler.InvalidFrame(error);
+};
+
+// Handlers with BinaryBegin/BinaryChunk/BinaryEnd members can get large payloads in pieces.
+template<typename Handler>
+concept BinaryStreamHandler = requires(Handler &handler, const Byte *data, std::size_t size) {
+    handler.BinaryBegin(size);
+    handler.BinaryChunk(data, size);
+    handler.BinaryEnd();
+};
+
+// Handlers with TextBegin/TextChunk/TextEnd members can get long text in pieces.
+template<typename Handler>
+concept TextStreamHandler = requires(Handler &handler, const Byte *data, std::size_t size) {
+    handler.TextBegin();
+    handler.TextChunk(data, size);
+    handler.TextEnd();
+};
+
+// Bounds on what a peer can make a receiver hold. A frame over a limit is dropped. Text is skipped
+// past its terminator and a binary payload of plausible size as a whole; after a binary length
+// which is likely garbage the receiver resynchronizes: it skips bytes up to the next start byte or
+// past the next text terminator.
+struct ReceiverConfig {
+    std::size_t maxBinaryPayload = std::numeric_limits<std::uint32_t>::max();
+    std::size_t maxTextLength = std::numeric_limits<std::size_t>::max();
+    // a frame which doesn't arrive in one piece is buffered only up to this size
+    std::size_t maxBufferedBytes = std::numeric_limits<std::size_t>::max();
+    // Binary payloads of this size and more are streamed to a BinaryStreamHandler without being
+    // buffered, so they don't count against maxBufferedBytes. Off by default.
+    std::size_t streamBinaryFrom = std::numeric_limits<std::size_t>::max();
+    // Text which has reached this many bytes without a terminator is streamed to a
+    // TextStreamHandler from then on. Streamed text isn't buffered, it's subject to neither
+    // maxTextLength nor maxBufferedBytes. Off by default.
+    std::size_t streamTextFrom = std::numeric_limits<std::size_t>::max();
+    // Where the receiver adds up what it does, not owned. Several receivers may share one, at the
+    // price of contended atomics.
+    ReceiverStats *stats = nullptr;
+    // Enables compressed frames, not owned. Their original sizes are bounded by maxBinaryPayload
+    // and maxTextLength, their frames by the binary limits.
+    const ICodec *codec = nullptr;
+    // A compressed frame may claim an original size of at most this many times its compressed
+    // bytes. It is checked before the storage for the decompressed packet is taken, so a small
+    // frame can't make the receiver allocate much.
+    std::size_t maxCompressionRatio = 1024;
+    // Binary frames carry a CRC32C trailer, both ends have to agree. One which doesn't match drops
+    // the start byte: the size may be what is corrupt, so the receiver resynchronizes right after
+    // it. Streamed payloads are checked at their end, a mismatch is reported before BinaryEnd.
+    // Senders produce the trailers with packChecksummedTo, or GatherEncoder, FrameBatcher and
+    // CompressingEncoder with their checksums option.
+    bool checksums = false;
+    // Where the reassembly buffer and the storage of decompressed packets come from, not owned.
+    // With a pool the receiver holds storage only while it has an incomplete frame, and a frame it
+    // can't get storage for is dropped as over the buffer limit. Without one the buffer keeps the
+    // capacity of the largest frame, see trimBuffer().
+    BufferPool *bufferPool = nullptr;
+};
+
+// Receiver with the handler type known at compile time, so the parse loop and the handler calls can
+// be inlined together. Handler is either a value type or a reference, e.g. ICallback &.
+template<typename Handler, typename Tracer = DefaultTracer>
+struct BasicReceiver {
+    explicit BasicReceiver(Handler handler_, ReceiverConfig config_ = {}, Tracer tracer_ = {})
+            : handler(std::forward<Handler>(handler_)),
+              config(config_),
+              tracer(std::move(tracer_)),
+              buffer(config.bufferPool),
+              inflated(config.bufferPool) {
+    }
+
+    ~BasicReceiver() {
+        trace<TraceLevel::Info>(tracer, __func__, ", buffer size=", buffer.size(), ", dropped bytes=", dropped);
+    }
+
+    BasicReceiver(const BasicReceiver &receiver) = delete;
+
+    BasicReceiver &operator=(const BasicReceiver &receiver) = delete;
+
+    std::remove_reference_t<Handler> &getHandler() noexcept {
+        return handler;
+    }
+
+    [[nodiscard]] std::size_t bufferedBytes() const noexcept {
+        return buffer.size();
+    }
+
+    // bytes of dropped frames and bytes skipped while resynchronizing
+    [[nodiscard]] std::size_t droppedBytes() const noexcept {
+        return dropped;
+    }
+
+    // storage held by the reassembly buffer
+    [[nodiscard]] std::size_t bufferCapacity() const noexcept {
+        return buffer.capacity();
+    }
+
+    // Shrinks the reassembly buffer to what its incomplete frame needs, freeing it if there is
+    // none, and frees the storage of decompressed packets. For connections gone idle, which
+    // otherwise keep the storage of their largest frame.
+    void trimBuffer() {
+        buffer.shrinkToFit();
+        inflated.shrinkToFit();
+    }
+
+    void Receive(const Byte *data, std::size_t size) {
+        trace<TraceLevel::Debug>(tracer, __func__, " data=", static_cast<const void *>(data), ", size=", size);
+
+        if (size == 0) {
+            return;
+        }
+
+        const auto *ptr = data;
+        const auto *endData = data + size;
+        // only the bytes the pending packet still misses go through the buffer; once more if the
+        // packet was bad and what it buffered left another one pending
+        while (!buffer.empty() && ptr < endData) {
+            ptr = completePendingPacket(ptr, endData);
+        }
+        if (buffer.empty()) {
+            // complete packets are handed to the callback straight from the caller's memory
+            ptr = parsePackets(ptr, endData);
+        }
+        deliverBatch();
+        // a delivered packet may have been in the buffer, so it's reused only now
+        if (ptr < endData && !buffer.append(ptr, endData - ptr)) {
+            dropUnbuffered(ptr, endData);
+        }
+        buffer.releaseIfEmpty();
+        flushCounts();
+    }
+
+    // Room for reading up to size bytes straight into the reassembly buffer, behind the pending
+    // packet. Valid until the next call of a member. Empty if the buffer pool has no room, the
+    // bytes can still go to Receive.
+    std::span<Byte> readBuffer(std::size_t size) {
+        auto *ptr = buffer.prepare(size);
+        return {ptr, ptr != nullptr ? size : 0};
+    }
+
+    // Parses the size bytes read into readBuffer() in place together with the pending packet they
+    // continue, so they aren't copied again. Only what is still incomplete stays in the buffer.
+    void commitRead(std::size_t size) {
+        trace<TraceLevel::Debug>(tracer, __func__, " size=", size);
+
+        if (size == 0) {
+            return;
+        }
+        buffer.commit(size);
+        const auto *ptr = parsePackets(buffer.data(), buffer.data() + buffer.size());
+        deliverBatch();
+        buffer.consume(ptr - buffer.data());
+        buffer.releaseIfEmpty();
+        flushCounts();
+    }
+
+private:
+    void deliver(PacketType type, const Byte *data, std::size_t size) {
+        trace<TraceLevel::Debug>(tracer, type == PacketType::Binary ? "BinaryPacket" : "TextPacket",
+                                 '\n', HexDump{data, size});
+        countPacket(type, size);
+        if constexpr (BatchHandler<Handler>) {
+            batch.push_back({type, data, size});
+            // a large Receive call or replayed capture doesn't pile up views, they stay valid
+            if (batch.size() == MAX_BATCH_PACKETS) {
+                deliverBatch();
+            }
+        } else if (type == PacketType::Binary) {
+            timeCallback([&] { handler.BinaryPacket(data, size); });
+        } else {
+            timeCallback([&] { handler.TextPacket(data, size); });
+        }
+    }
+
+    void deliverBatch() {
+        if constexpr (BatchHandler<Handler>) {
+            if (!batch.empty()) {
+                timeCallback([this] { handler.Packets(batch); });
+                batch.clear();
+            }
+        }
+    }
+
+    void countPacket(PacketType type, std::size_t size) noexcept {
+        if (type == PacketType::Binary) {
+            ++counts.binaryPackets;
+            counts.binaryBytes += size;
+        } else {
+            ++counts.textPackets;
+            counts.textBytes += size;
+        }
+    }
+
+    template<typename Function>
+    void timeCallback(Function &&function) {
+        if (config.stats != nullptr && config.stats->measuresLatency()) {
+            const auto start = std::chrono::steady_clock::now();
+            function();
+            config.stats->recordLatency(std::chrono::steady_clock::now() - start);
+        } else {
+            function();
+        }
+    }
+
+    // Adds what the Receive call did to the attached stats.
+    void flushCounts() noexcept {
+        if (config.stats == nullptr) {
+            return;
+        }
+        ++counts.receiveCalls;
+        if (!buffer.empty()) {
+            ++counts.partialFrames;
+        }
+        config.stats->add(counts, buffer.size());
+        counts = {};
+    }
+
+    // Drops size bytes of a bad frame. The caller decides how the rest of the frame is skipped.
+    void dropFrame(FrameError error, std::size_t size) {
+        trace<TraceLevel::Info>(tracer, __func__, " error=", static_cast<int>(error), ", size=", size);
+        dropped += size;
+        ++counts.droppedFrames;
+        if constexpr (FrameErrorHandler<Handler>) {
+            // packets parsed before the bad frame go first
+            deliverBatch();
+            handler.InvalidFrame(error);
+        }
+    }
+
+    // Drops the frame which starts in the buffer (or at ptr if it's empty) and goes on in
+    // [ptr, endData), when the buffer pool had no room for it.
+    void dropUnbuffered(const Byte *ptr, const Byte *endData) {
+        const std::size_t buffered = buffer.size();
+        std::array<Byte, BINARY_HEADER_SIZE> header{};
+        const auto headerBytes = std::min<std::size_t>(BINARY_HEADER_SIZE, buffered + (endData - ptr));
+        std::copy_n(buffer.data(), std::min(buffered, headerBytes), header.begin());
+        if (headerBytes > buffered) {
+            std::copy_n(ptr, headerBytes - buffered, header.begin() + buffered);
+        }
+        const std::size_t available = buffered + (endData - ptr);
+        dropFrame(FrameError::BufferLimit, available);
+        buffer.clear();
+        if (!isBinaryFrame(header[0])) {
+            // textScan goes on looking for the terminator
+            skippingText = true;
+        } else if (headerBytes == BINARY_HEADER_SIZE) {
+            // the rest of the frame has a known size
+            discarding = BINARY_HEADER_SIZE + readPayloadSize(header.data()) + trailerBytes() - available;
+        } else {
+            resyncing = true;
+        }
+    }
+
+    // Starts streaming the payload whose header was just parsed, if it's to be streamed.
+    bool beginBinaryStream(std::size_t payloadSize) {
+        if constexpr (BinaryStreamHandler<Handler>) {
+            if (payloadSize >= config.streamBinaryFrom && payloadSize <= config.maxBinaryPayload) {
+                // packets parsed before go first
+                deliverBatch();
+                trace<TraceLevel::Debug>(tracer, "BinaryBegin size=", payloadSize);
+                handler.BinaryBegin(payloadSize);
+                streamingBinary = true;
+                streamingRemaining = payloadSize;
+                if (config.checksums) {
+                    const auto sizeField = encodeBinSize(static_cast<BinSize>(payloadSize));
+                    streamingChecksum = crc32cUpdate(CRC32C_INIT, sizeField.data(), sizeField.size());
+                    trailerSize = 0;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const Byte *streamBinary(const Byte *ptr, const Byte *endData) {
+        if constexpr (BinaryStreamHandler<Handler>) {
+            const auto count = std::min<std::size_t>(streamingRemaining, endData - ptr);
+            if (count > 0) {
+                trace<TraceLevel::Debug>(tracer, "BinaryChunk", '\n', HexDump{ptr, count});
+                handler.BinaryChunk(ptr, count);
+                counts.binaryBytes += count;
+                if (config.checksums) {
+                    streamingChecksum = crc32cUpdate(streamingChecksum, ptr, count);
+                }
+                ptr += count;
+                streamingRemaining -= count;
+            }
+            if (streamingRemaining == 0) {
+                if (config.checksums) {
+                    const auto count = std::min<std::size_t>(CHECKSUM_SIZE - trailerSize, endData - ptr);
+                    std::copy(ptr, ptr + count, trailer.begin() + trailerSize);
+                    ptr += count;
+                    trailerSize += count;
+                    if (trailerSize < CHECKSUM_SIZE) {
+                        return ptr;
+                    }
+                    if (decodeBinSize(trailer.data()) != crc32cFinish(streamingChecksum)) {
+                        dropFrame(FrameError::BadChecksum, 0);
+                    }
+                }
+                ++counts.binaryPackets;
+                handler.BinaryEnd();
+                streamingBinary = false;
+            }
+        }
+        return ptr;
+    }
+
+    // Starts streaming the text packet whose terminator is still missing, if it's to be streamed.
+    bool beginTextStream(std::size_t textSize) {
+        if constexpr (TextStreamHandler<Handler>) {
+            if (textSize >= config.streamTextFrom) {
+                // packets parsed before go first
+                deliverBatch();
+                trace<TraceLevel::Debug>(tracer, "TextBegin");
+                handler.TextBegin();
+                streamingText = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void textChunk(const Byte *data, std::size_t size) {
+        if constexpr (TextStreamHandler<Handler>) {
+            if (size > 0) {
+                trace<TraceLevel::Debug>(tracer, "TextChunk", '\n', HexDump{data, size});
+                handler.TextChunk(data, size);
+                counts.textBytes += size;
+            }
+        }
+    }
+
+    // Streams the text up to its terminator. The last bytes which may start the terminator are held
+    // back; they are a prefix of ENDING_TEXT_BLOCK, so once they turn out to be text they are
+    // delivered from there.
+    const Byte *streamText(const Byte *ptr, const Byte *endData) {
+        if constexpr (TextStreamHandler<Handler>) {
+            const auto held = textScan.matched;
+            const auto *end = findTextEnding(ptr, endData, textScan);
+            if (end != nullptr) {
+                // held bytes are either the start of this terminator or text
+                if (held == 0 || end != ptr + (ENDING_TEXT_BLOCK.size() - held)) {
+                    textChunk(ENDING_TEXT_BLOCK.data(), held);
+                    textChunk(ptr, end - ptr - ENDING_TEXT_BLOCK.size());
+                }
+                ++counts.textPackets;
+                handler.TextEnd();
+                streamingText = false;
+                textScan = {};
+                return end;
+            }
+            // all new bytes may have extended the held ones
+            if (held == 0 || textScan.matched != held + (endData - ptr)) {
+                textChunk(ENDING_TEXT_BLOCK.data(), held);
+                textChunk(ptr, (endData - ptr) - textScan.matched);
+            }
+        }
+        return endData;
+    }
+
+    // A payload of a plausible size which is only over the buffer limit is skipped as a whole,
+    // otherwise the length is likely garbage and the receiver resynchronizes.
+    void skipBinary(std::size_t payloadSize, std::size_t remainingBytes) noexcept {
+        if (payloadSize <= config.maxBinaryPayload) {
+            discarding = remainingBytes;
+        } else {
+            resyncing = true;
+        }
+    }
+
+    // Skips the rest of a dropped text frame, up to and past its terminator. Text may contain start
+    // bytes anywhere but at its front, they don't end it.
+    const Byte *skipText(const Byte *ptr, const Byte *endData) {
+        // textScan carries the search from the dropped part
+        const auto *end = findTextEnding(ptr, endData, textScan);
+        if (end == nullptr) {
+            dropped += endData - ptr;
+            return endData;
+        }
+        dropped += end - ptr;
+        skippingText = false;
+        textScan = {};
+        return end;
+    }
+
+    // Skips to the next start byte or past the next terminator, whichever comes first.
+    const Byte *skipToNextFrame(const Byte *ptr, const Byte *endData) {
+        auto *start = findByte(ptr, endData, START_BYTE_BINARY_BLOCK);
+        if (config.codec != nullptr) {
+            start = findByte(ptr, start, START_BYTE_COMPRESSED_BLOCK);
+        }
+        // textScan carries a terminator split between calls
+        const auto *next = findTextEnding(ptr, start, textScan);
+        if (next == nullptr && start != endData) {
+            next = start;
+        }
+        if (next == nullptr) {
+            dropped += endData - ptr;
+            return endData;
+        }
+        dropped += next - ptr;
+        resyncing = false;
+        textScan = {};
+        return next;
+    }
+
+    // frames with a binary header, compressed ones when there's a codec
+    [[nodiscard]] bool isBinaryFrame(Byte start) const noexcept {
+        return start == START_BYTE_BINARY_BLOCK || (start == START_BYTE_COMPRESSED_BLOCK && config.codec != nullptr);
+    }
+
+    // Decompresses the payload of a compressed frame to storage taken for it, from the buffer pool
+    // if there is one, and delivers the packet it was. Pool storage is given back right after,
+    // otherwise it's kept for the next frames like the reassembly buffer's, see trimBuffer().
+    void deliverCompressed(const Byte *data, std::size_t size) {
+        const std::size_t frameSize = BINARY_HEADER_SIZE + size;
+        if (size < COMPRESSED_HEADER_SIZE || data[0] > static_cast<Byte>(PacketType::Text)) {
+            dropFrame(FrameError::BadCompressedFrame, frameSize);
+            return;
+        }
+        const auto type = static_cast<PacketType>(data[0]);
+        const std::size_t originalSize = decodeBinSize(data + 1);
+        if (type == PacketType::Binary ? originalSize > config.maxBinaryPayload : originalSize > config.maxTextLength) {
+            dropFrame(type == PacketType::Binary ? FrameError::BinaryTooLarge : FrameError::TextTooLong, frameSize);
+            return;
+        }
+        const std::size_t compressedSize = size - COMPRESSED_HEADER_SIZE;
+        if (originalSize / std::max(config.maxCompressionRatio, std::size_t{1}) > compressedSize) {
+            dropFrame(FrameError::BadCompressedFrame, frameSize);
+            return;
+        }
+        auto *out = inflated.prepare(originalSize);
+        if (out == nullptr) {
+            dropFrame(FrameError::BufferLimit, frameSize);
+            return;
+        }
+        if (!config.codec->decompress(data + COMPRESSED_HEADER_SIZE, compressedSize, out, originalSize)) {
+            dropFrame(FrameError::BadCompressedFrame, frameSize);
+        } else {
+            // delivered before the storage goes, with the packets batched before it
+            deliver(type, out, originalSize);
+            deliverBatch();
+        }
+        inflated.releaseIfEmpty();
+    }
+
+    static BinSize readPayloadSize(const Byte *header) noexcept {
+        return decodeBinSize(header + sizeof(START_BYTE_BINARY_BLOCK));
+    }
+
+    [[nodiscard]] bool isBinaryAcceptable(std::size_t payloadSize, bool buffered) const noexcept {
+        return payloadSize <= config.maxBinaryPayload &&
+               (!buffered || BINARY_HEADER_SIZE + payloadSize + trailerBytes() <= config.maxBufferedBytes);
+    }
+
+    [[nodiscard]] std::size_t trailerBytes() const noexcept {
+        return config.checksums ? CHECKSUM_SIZE : 0;
+    }
+
+    // Checks the trailer of the complete binary frame at frame.
+    [[nodiscard]] bool isChecksumValid(const Byte *frame, std::size_t payloadSize) const noexcept {
+        if (!config.checksums) {
+            return true;
+        }
+        const auto *sizeField = frame + sizeof(START_BYTE_BINARY_BLOCK);
+        return crc32c(sizeField, sizeof(BinSize) + payloadSize) == decodeBinSize(sizeField + sizeof(BinSize) + payloadSize);
+    }
+
+    [[nodiscard]] FrameError binaryError(std::size_t payloadSize) const noexcept {
+        return payloadSize > config.maxBinaryPayload ? FrameError::BinaryTooLarge : FrameError::BufferLimit;
+    }
+
+    // Parses complete packets in [ptr, endData), returns the start of the packet which isn't complete.
+    const Byte *parsePackets(const Byte *ptr, const Byte *endData) {
+        while (ptr < endData) {
+            if (streamingBinary) {
+                ptr = streamBinary(ptr, endData);
+            } else if (streamingText) {
+                ptr = streamText(ptr, endData);
+            } else if (discarding > 0) {
+                const auto count = std::min<std::size_t>(discarding, endData - ptr);
+                ptr += count;
+                discarding -= count;
+                dropped += count;
+            } else if (skippingText) {
+                ptr = skipText(ptr, endData);
+            } else if (resyncing) {
+                ptr = skipToNextFrame(ptr, endData);
+            } else if (isBinaryFrame(*ptr)) {
+                const std::size_t left = endData - ptr;
+                if (left < BINARY_HEADER_SIZE) {
+                    break;
+                }
+                const auto payloadSize = readPayloadSize(ptr);
+                const bool compressed = *ptr == START_BYTE_COMPRESSED_BLOCK;
+                if (!compressed && beginBinaryStream(payloadSize)) {
+                    ptr = streamBinary(ptr + BINARY_HEADER_SIZE, endData);
+                    continue;
+                }
+                const bool complete = payloadSize + trailerBytes() <= left - BINARY_HEADER_SIZE;
+                if (!isBinaryAcceptable(payloadSize, !complete)) {
+                    dropFrame(binaryError(payloadSize), sizeof(START_BYTE_BINARY_BLOCK));
+                    ptr += sizeof(START_BYTE_BINARY_BLOCK);
+                    skipBinary(payloadSize, sizeof(BinSize) + payloadSize + trailerBytes());
+                    continue;
+                }
+                if (!complete) {
+                    break;
+                }
+                if (!isChecksumValid(ptr, payloadSize)) {
+                    dropFrame(FrameError::BadChecksum, sizeof(START_BYTE_BINARY_BLOCK));
+                    ptr += sizeof(START_BYTE_BINARY_BLOCK);
+                    resyncing = true;
+                    continue;
+                }
+                if (compressed) {
+                    deliverCompressed(ptr + BINARY_HEADER_SIZE, payloadSize);
+                } else {
+                    deliver(PacketType::Binary, ptr + BINARY_HEADER_SIZE, payloadSize);
+                }
+                ptr += BINARY_HEADER_SIZE + payloadSize + trailerBytes();
+            } else {
+                // a text packet left in the buffer by commitRead was scanned already
+                const auto *end = findTextEnding(ptr + textScan.scanned, endData, textScan);
+                if (end == nullptr) {
+                    const std::size_t left = endData - ptr;
+                    if (beginTextStream(left)) {
+                        // all but the bytes which may start the terminator
+                        textChunk(ptr, left - textScan.matched);
+                        return endData;
+                    }
+                    // the trailing bytes which may start the terminator aren't text
+                    const bool tooLong = left - textScan.matched > config.maxTextLength;
+                    if (tooLong || left > config.maxBufferedBytes) {
+                        // textScan goes on looking for the terminator, start bytes in the text are text
+                        dropFrame(tooLong ? FrameError::TextTooLong : FrameError::BufferLimit, left);
+                        skippingText = true;
+                        return endData;
+                    }
+                    // the text packet goes to the buffer, textScan remembers how far it was scanned
+                    break;
+                }
+                // text and separator in a block
+                const std::size_t textSize = end - ptr - ENDING_TEXT_BLOCK.size();
+                if (textSize > config.maxTextLength) {
+                    dropFrame(FrameError::TextTooLong, end - ptr);
+                } else {
+                    deliver(PacketType::Text, ptr, textSize);
+                }
+                ptr = end;
+                textScan = {};
+            }
+        }
+        return ptr;
+    }
+
+    // Parses the buffered bytes in place like commitRead, only an incomplete packet stays. The
+    // packets are delivered right away, the buffer may be appended to next.
+    void reparseBuffer() {
+        const auto *ptr = parsePackets(buffer.data(), buffer.data() + buffer.size());
+        deliverBatch();
+        buffer.consume(ptr - buffer.data());
+    }
+
+    // Appends to the packet at the front of the buffer only the bytes it misses and delivers it once
+    // it's complete. Returns the first byte of [ptr, endData) which doesn't belong to that packet.
+    const Byte *completePendingPacket(const Byte *ptr, const Byte *endData) {
+        if (isBinaryFrame(*buffer.data())) {
+            const bool compressed = *buffer.data() == START_BYTE_COMPRESSED_BLOCK;
+            if (buffer.size() < BINARY_HEADER_SIZE) {
+                const std::size_t count = std::min<std::size_t>(BINARY_HEADER_SIZE - buffer.size(), endData - ptr);
+                if (!buffer.append(ptr, count)) {
+                    dropUnbuffered(ptr, ptr + count);
+                    return ptr + count;
+                }
+                ptr += count;
+                if (buffer.size() < BINARY_HEADER_SIZE) {
+                    return ptr;
+                }
+                const auto payloadSize = readPayloadSize(buffer.data());
+                if (!compressed && beginBinaryStream(payloadSize)) {
+                    buffer.clear();
+                    return streamBinary(ptr, endData);
+                }
+                if (!isBinaryAcceptable(payloadSize, true)) {
+                    // as in place, the size bytes are scanned again if the size is likely garbage
+                    dropFrame(binaryError(payloadSize), sizeof(START_BYTE_BINARY_BLOCK));
+                    buffer.consume(sizeof(START_BYTE_BINARY_BLOCK));
+                    skipBinary(payloadSize, sizeof(BinSize) + payloadSize + trailerBytes());
+                    reparseBuffer();
+                    return ptr;
+                }
+            }
+            const std::size_t payloadSize = readPayloadSize(buffer.data());
+            const std::size_t packetSize = BINARY_HEADER_SIZE + payloadSize + trailerBytes();
+            const std::size_t count = std::min<std::size_t>(packetSize - buffer.size(), endData - ptr);
+            if (!buffer.append(ptr, count)) {
+                dropUnbuffered(ptr, ptr + count);
+                return ptr + count;
+            }
+            ptr += count;
+            if (buffer.size() == packetSize) {
+                if (!isChecksumValid(buffer.data(), payloadSize)) {
+                    // The size may be what is corrupt, so as for a frame parsed in place only the
+                    // start byte is dropped and the bytes after it are parsed again.
+                    dropFrame(FrameError::BadChecksum, sizeof(START_BYTE_BINARY_BLOCK));
+                    buffer.consume(sizeof(START_BYTE_BINARY_BLOCK));
+                    resyncing = true;
+                    reparseBuffer();
+                    return ptr;
+                }
+                if (compressed) {
+                    deliverCompressed(buffer.data() + BINARY_HEADER_SIZE, payloadSize);
+                    ++counts.reassembledPackets;
+                } else {
+                    deliver(PacketType::Binary, buffer.data() + BINARY_HEADER_SIZE, payloadSize);
+                    ++counts.reassembledPackets;
+                }
+                // the bytes stay intact until the next append
+                buffer.consume(packetSize);
+            }
+            return ptr;
+        }
+        const auto *end = findTextEnding(ptr, endData, textScan);
+        if (end == nullptr) {
+            const std::size_t textSize = buffer.size() + (endData - ptr);
+            if (beginTextStream(textSize)) {
+                // all but the bytes which may start the terminator, they can be split between the
+                // buffer and the new data
+                const std::size_t known = textSize - textScan.matched;
+                const std::size_t fromBuffer = std::min(known, buffer.size());
+                textChunk(buffer.data(), fromBuffer);
+                textChunk(ptr, known - fromBuffer);
+                buffer.clear();
+                return endData;
+            }
+            const bool tooLong = textSize - textScan.matched > config.maxTextLength;
+            if (tooLong || textSize > config.maxBufferedBytes) {
+                dropFrame(tooLong ? FrameError::TextTooLong : FrameError::BufferLimit, textSize);
+                buffer.clear();
+                skippingText = true;
+            } else if (!buffer.append(ptr, endData - ptr)) {
+                dropUnbuffered(ptr, endData);
+            }
+            return endData;
+        }
+        if (buffer.size() + (end - ptr) - ENDING_TEXT_BLOCK.size() > config.maxTextLength) {
+            dropFrame(FrameError::TextTooLong, buffer.size() + (end - ptr));
+            buffer.clear();
+        } else if (!buffer.append(ptr, end - ptr)) {
+            // complete, nothing more to skip
+            dropFrame(FrameError::BufferLimit, buffer.size() + (end - ptr));
+            buffer.clear();
+        } else {
+            deliver(PacketType::Text, buffer.data(), buffer.size() - ENDING_TEXT_BLOCK.size());
+            ++counts.reassembledPackets;
+            buffer.consume(buffer.size());
+        }
+        textScan = {};
+        return end;
+    }
+
+    Handler handler;
+    const ReceiverConfig config;
+    [[no_unique_address]] Tracer tracer;
+    ByteBuffer buffer;
+    // packets parsed by the current Receive call, used by batch handlers
+    std::vector<PacketView> batch;
+    TextScan textScan;
+    // a payload is being streamed to the handler
+    bool streamingBinary = false;
+    std::size_t streamingRemaining = 0;
+    // a text packet is being streamed to the handler
+    bool streamingText = false;
+    // bytes left of a dropped frame of known size
+    std::size_t discarding = 0;
+    // skipping the rest of a dropped text frame
+    bool skippingText = false;
+    // skipping garbage after a dropped frame of unknown size
+    bool resyncing = false;
+    std::size_t dropped = 0;
+    // checksum of the payload being streamed and its trailer so far
+    std::uint32_t streamingChecksum = 0;
+    std::array<Byte, CHECKSUM_SIZE> trailer{};
+    std::size_t trailerSize = 0;
+    // the decompressed packet being delivered, empty otherwise
+    ByteBuffer inflated;
+    // this Receive call's share of the stats
+    ReceiveCounts counts;
+};
+
+struct Receiver : public IReceiver {
+    explicit Receiver(std::shared_ptr<ICallback> callback_, ReceiverConfig config = {})
+            : callback(std::move(callback_)),
+              receiver(*callback, config) {
+    }
+
+    ~Receiver() override = default;
+
+    Receiver(const Receiver &receiver) = delete;
+
+    Receiver &operator=(const Receiver &receiver) = delete;
+
+    void Receive(const Byte *data, std::size_t size) override {
+        receiver.Receive(data, size);
+    }
+
+    std::span<Byte> readBuffer(std::size_t size) {
+        return receiver.readBuffer(size);
+    }
+
+    void commitRead(std::size_t size) {
+        receiver.commitRead(size);
+    }
+
+    void trimBuffer() {
+        receiver.trimBuffer();
+    }
+
+private:
+    std::shared_ptr<ICallback> callback;
+    BasicReceiver<ICallback &> receiver;
+};
+
+template<typename T>
+constexpr bool IS_TEXT_VALUE = std::is_same_v<const char *, std::decay_t<T>>;
+
+template<typename T>
+constexpr bool IS_POD = std::is_standard_layout_v<T> && std::is_trivial_v<T>;
+
+// Contiguous ranges of pods, e.g. std::vector or std::span, go as one binary block of all the
+// elements. Strings aren't ranges here, and neither are pods such as std::array which already go as
+// one block.
+template<typename T>
+constexpr bool IS_RANGE_VALUE = [] {
+    using Type = std::decay_t<T>;
+    if constexpr (std::ranges::contiguous_range<Type> && std::ranges::sized_range<Type>) {
+        return IS_POD<std::ranges::range_value_t<Type>> && !IS_POD<Type> &&
+               !std::is_convertible_v<const Type &, std::string_view>;
+    } else {
+        return false;
+    }
+}();
+
+// the bytes a binary block carries for a value
+template<typename T>
+const Byte *payloadBytes(const T &value) noexcept {
+    if constexpr (IS_RANGE_VALUE<T>) {
+        return reinterpret_cast<const Byte *>(std::ranges::data(value));
+    } else {
+        return reinterpret_cast<const Byte *>(&value);
+    }
+}
+
+template<typename OutputIt>
+constexpr OutputIt packBinaryHeader(std::size_t payloadSize, OutputIt out) {
+    const auto size = encodeBinSize(static_cast<BinSize>(payloadSize));
+    *out++ = START_BYTE_BINARY_BLOCK;
+    return std::copy(size.begin(), size.end(), out);
+}
+
+// Writes one value: a binary block for a pod, a text block for a string of length bytes.
+template<typename T, typename OutputIt>
+OutputIt packValue(const T &value, std::size_t length, OutputIt out) {
+    if constexpr (IS_TEXT_VALUE<T>) {
+        out = std::copy(value, value + length, out);
+        return std::copy(std::begin(ENDING_TEXT_BLOCK), std::end(ENDING_TEXT_BLOCK), out);
+    } else {
+        out = packBinaryHeader(length, out);
+        const auto *bytes = payloadBytes(value);
+        return std::copy(bytes, bytes + length, out);
+    }
+}
+
+template<typename T>
+std::size_t pack(T value, std::size_t pos, Byte * const ptr) noexcept {
+    return packValue(value, sizeof(value), ptr + pos) - ptr;
+}
+
+template<>
+inline std::size_t pack<const char *>(const char *value, std::size_t pos, Byte * const ptr) noexcept {
+    return packValue(value, std::strlen(value), ptr + pos) - ptr;
+}
+
+// Sizes computed by the first pass over a tuple, so strings are measured only once.
+template<typename ...Ts>
+struct PackLayout {
+    // payload or text bytes of every value
+    std::array<std::size_t, sizeof...(Ts)> lengths;
+    // bytes of the whole block
+    std::size_t size;
+    // a binary payload is over MAX_PAYLOAD_SIZE, the block can't be framed
+    bool oversized;
+};
+
+// Throws std::length_error for a block which can't be framed, before any of it is written: its size
+// field would contradict its payload.
+template<typename ...Ts>
+void checkPayloadSizes(const PackLayout<Ts...> &layout) {
+    if (layout.oversized) {
+        throw std::length_error("binary payload over MAX_PAYLOAD_SIZE");
+    }
+}
+
+template<typename ...Ts>
+PackLayout<Ts...> packLayout(const std::tuple<Ts...> &values) noexcept {
+    PackLayout<Ts...> layout{{}, 0, false};
+    std::apply([&layout](const auto &... args) {
+        std::size_t index = 0;
+        ((
+                [&layout, &index](const auto &value) {
+                    using Type = typename std::decay<decltype(value)>::type;
+                    static_assert(IS_POD<Type> || IS_RANGE_VALUE<Type>, "type is not a pod");
+                    if constexpr (IS_TEXT_VALUE<Type>) {
+                        layout.lengths[index] = std::strlen(value);
+                        layout.size += layout.lengths[index] + ENDING_TEXT_BLOCK.size();
+                    } else if constexpr (IS_RANGE_VALUE<Type>) {
+                        layout.lengths[index] = std::ranges::size(value) * sizeof(std::ranges::range_value_t<Type>);
+                        layout.size += BINARY_HEADER_SIZE + layout.lengths[index];
+                        layout.oversized |= layout.lengths[index] > MAX_PAYLOAD_SIZE;
+                    } else {
+                        layout.lengths[index] = sizeof(Type);
+                        layout.size += BINARY_HEADER_SIZE + sizeof(Type);
+                    }
+                    ++index;
+                }(args)
+        ), ...);
+    }, values);
+    return layout;
+}
+
+template<typename OutputIt, typename ...Ts>
+OutputIt packTo(OutputIt out, const std::tuple<Ts...> &values, const PackLayout<Ts...> &layout) {
+    std::apply([&out, &layout](const auto &... args) {
+        std::size_t index = 0;
+        ((out = packValue(args, layout.lengths[index++], out)), ...);
+    }, values);
+    return out;
+}
+
+// Writes the block of values to out, e.g. a std::back_inserter of a reused vector. Throws
+// std::length_error if a payload is over MAX_PAYLOAD_SIZE.
+template<typename OutputIt, typename ...Ts>
+OutputIt packTo(OutputIt out, const std::tuple<Ts...> &values) {
+    const auto layout = packLayout(values);
+    checkPayloadSizes(layout);
+    return packTo(out, values, layout);
+}
+
+// Writes one value like packValue, with the CRC32C trailer of ReceiverConfig::checksums after a
+// binary block. The checksum goes over the payload in pieces as they are copied, so each piece is
+// read again from the cache.
+template<typename T, typename OutputIt>
+OutputIt packChecksummedValue(const T &value, std::size_t length, OutputIt out) {
+    if constexpr (IS_TEXT_VALUE<T>) {
+        return packValue(value, length, out);
+    } else {
+        constexpr std::size_t PIECE_SIZE = 4 << 10;
+        const auto sizeField = encodeBinSize(static_cast<BinSize>(length));
+        *out++ = START_BYTE_BINARY_BLOCK;
+        out = std::copy(sizeField.begin(), sizeField.end(), out);
+        auto checksum = crc32cUpdate(CRC32C_INIT, sizeField.data(), sizeField.size());
+        const auto *bytes = payloadBytes(value);
+        for (std::size_t pos = 0; pos < length; pos += PIECE_SIZE) {
+            const auto count = std::min(PIECE_SIZE, length - pos);
+            checksum = crc32cUpdate(checksum, bytes + pos, count);
+            out = std::copy(bytes + pos, bytes + pos + count, out);
+        }
+        const auto trailer = encodeBinSize(crc32cFinish(checksum));
+        return std::copy(trailer.begin(), trailer.end(), out);
+    }
+}
+
+// Writes the block of values for a receiver with checksums on, throws like packTo.
+template<typename OutputIt, typename ...Ts>
+OutputIt packChecksummedTo(OutputIt out, const std::tuple<Ts...> &values) {
+    const auto layout = packLayout(values);
+    checkPayloadSizes(layout);
+    std::apply([&out, &layout](const auto &... args) {
+        std::size_t index = 0;
+        ((out = packChecksummedValue(args, layout.lengths[index++], out)), ...);
+    }, values);
+    return out;
+}
+
+struct PackResult {
+    // bytes written, or bytes needed when the block doesn't fit
+    std::size_t size;
+    bool fits;
+};
+
+// Writes the block of values to the beginning of buffer. Nothing is written if it doesn't fit,
+// which a block with a payload over MAX_PAYLOAD_SIZE never does.
+template<typename ...Ts>
+PackResult packInto(std::span<Byte> buffer, const std::tuple<Ts...> &values) noexcept {
+    const auto layout = packLayout(values);
+    if (layout.size > buffer.size() || layout.oversized) {
+        return {layout.size, false};
+    }
+    packTo(buffer.data(), values, layout);
+    return {layout.size, true};
+}
+
+// packInto for a receiver with checksums on.
+template<typename ...Ts>
+PackResult packChecksummedInto(std::span<Byte> buffer, const std::tuple<Ts...> &values) noexcept {
+    constexpr std::size_t BINARY_BLOCKS = ((IS_TEXT_VALUE<Ts> ? 0 : 1) + ... + 0);
+    const auto layout = packLayout(values);
+    const auto size = layout.size + BINARY_BLOCKS * CHECKSUM_SIZE;
+    if (size > buffer.size() || layout.oversized) {
+        return {size, false};
+    }
+    packChecksummedTo(buffer.data(), values);
+    return {size, true};
+}
+
+// throws like packTo
+template<typename ...Ts>
+auto pack(std::tuple<Ts...> &&values) {
+    const auto layout = packLayout(values);
+    checkPayloadSizes(layout);
+    auto block = std::vector<Byte>(layout.size);
+    packTo(block.data(), values, layout);
+    return block;
+}
+
+// Blocks of pods only have a size known at compile time.
+template<typename ...Ts>
+constexpr bool IS_FIXED_SIZE_BLOCK = ((!IS_TEXT_VALUE<Ts> && !IS_RANGE_VALUE<Ts>) && ...);
+
+template<typename ...Ts>
+constexpr std::size_t FIXED_BLOCK_SIZE = ((BINARY_HEADER_SIZE + sizeof(Ts)) + ... + 0);
+
+// Same bytes as the vector returned for other tuples, without the heap and the sizing pass. Usable
+// in constant expressions for types std::bit_cast supports there.
+template<typename ...Ts> requires IS_FIXED_SIZE_BLOCK<Ts...>
+constexpr auto pack(std::tuple<Ts...> &&values) noexcept {
+    std::array<Byte, FIXED_BLOCK_SIZE<Ts...>> block{};
+    std::apply([&block](const auto &... args) {
+        auto *out = block.data();
+        ((
+                out = [](const auto &value, Byte *out) {
+                    using Type = typename std::decay<decltype(value)>::type;
+                    static_assert(IS_POD<Type>, "type is not a pod");
+                    out = packBinaryHeader(sizeof(Type), out);
+                    const auto bytes = std::bit_cast<std::array<Byte, sizeof(Type)>>(value);
+                    return std::copy(bytes.begin(), bytes.end(), out);
+                }(args, out)
+        ), ...);
+    }, values);
+    return block;
+}
+
+// Typed view of a binary payload packed from a range of pods. The payload has no alignment, so the
+// elements are copied out instead of being accessed through a T *.
+template<typename T>
+struct PodArrayView {
+    static_assert(IS_POD<T>, "type is not a pod");
+
+    PodArrayView() noexcept = default;
+
+    // size is in bytes, a multiple of sizeof(T)
+    PodArrayView(const Byte *data_, std::size_t size_) noexcept
+            : bytes(data_),
+              count(size_ / sizeof(T)) {
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return count;
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return count == 0;
+    }
+
+    T operator[](std::size_t index) const noexcept {
+        assert(index < count);
+        T value;
+        std::memcpy(&value, bytes + index * sizeof(T), sizeof(T));
+        return value;
+    }
+
+    // Copies all elements to out, which has room for size() of them.
+    void copyTo(T *out) const noexcept {
+        if (count > 0) {
+            std::memcpy(out, bytes, count * sizeof(T));
+        }
+    }
+
+    [[nodiscard]] const Byte *data() const noexcept {
+        return bytes;
+    }
+
+private:
+    const Byte *bytes = nullptr;
+    std::size_t count = 0;
+};
+
+template<typename T>
+struct UnpackedTypeOf {
+    using type = std::conditional_t<IS_TEXT_VALUE<T>, std::string_view, T>;
+};
+
+template<typename T> requires IS_RANGE_VALUE<T>
+struct UnpackedTypeOf<T> {
+    using type = PodArrayView<std::ranges::range_value_t<T>>;
+};
+
+// What unpack hands out for a value pack wrote from a T: a copy of the pod, a view of a string or of
+// the elements of a range.
+template<typename T>
+using UnpackedType = typename UnpackedTypeOf<T>::type;
+
+// Decodes a packet written by pack from a T. False if it can't have been, i.e. it is of the other
+// type or, for a pod, not of sizeof(T) bytes, or for a range, not of whole elements.
+template<typename T>
+bool unpackValue(const PacketView &packet, UnpackedType<T> &value) noexcept {
+    if constexpr (IS_TEXT_VALUE<T>) {
+        if (packet.type != PacketType::Text) {
+            return false;
+        }
+        value = {reinterpret_cast<const char *>(packet.data), packet.size};
+    } else if constexpr (IS_RANGE_VALUE<T>) {
+        if (packet.type != PacketType::Binary || packet.size % sizeof(std::ranges::range_value_t<T>) != 0) {
+            return false;
+        }
+        value = {packet.data, packet.size};
+    } else {
+        static_assert(IS_POD<T>, "type is not a pod");
+        if (packet.type != PacketType::Binary || packet.size != sizeof(T)) {
+            return false;
+        }
+        // the payload has no alignment
+        std::memcpy(&value, packet.data, sizeof(T));
+    }
+    return true;
+}
+
+// BasicReceiver handler which decodes the packets of a block packed from std::tuple<Ts...> and calls
+// function with the values, strings as std::string_view and ranges as PodArrayView. The views point
+// into the receiver's memory and are valid during the call; only a block split between Receive
+// calls has its viewed bytes copied, to storage reused by the next ones. A packet which doesn't fit
+// the schema where it arrives drops the values decoded so far and is tried as the first value of
+// the next block.
+template<typename Function, typename ...Ts>
+struct Unpacker {
+    explicit Unpacker(Function function_)
+            : function(std::move(function_)) {
+    }
+
+    void Packets(std::span<const PacketView> packets) {
+        for (const auto &packet: packets) {
+            if (!unpackAt(packet, std::index_sequence_for<Ts...>{})) {
+                ++mismatched;
+                const bool restarted = index > 0;
+                index = 0;
+                if (!restarted || !unpackAt(packet, std::index_sequence_for<Ts...>{})) {
+                    continue;
+                }
+            }
+            if (++index == sizeof...(Ts)) {
+                index = 0;
+                std::apply(function, values);
+            }
+        }
+        if (index > 0) {
+            // the rest of the block comes with a later Receive call
+            keepViews(std::index_sequence_for<Ts...>{});
+        }
+    }
+
+    // packets which didn't fit the schema where they arrived
+    [[nodiscard]] std::size_t mismatches() const noexcept {
+        return mismatched;
+    }
+
+    Function &getFunction() noexcept {
+        return function;
+    }
+
+private:
+    template<std::size_t ...Is>
+    bool unpackAt(const PacketView &packet, std::index_sequence<Is...>) noexcept {
+        return ((Is == index && unpackValue<Ts>(packet, std::get<Is>(values))) || ...);
+    }
+
+    template<std::size_t ...Is>
+    void keepViews(std::index_sequence<Is...>) {
+        ((Is < index ? keepView<Is>() : void()), ...);
+    }
+
+    template<std::size_t I>
+    void keepView() {
+        using Type = std::tuple_element_t<I, std::tuple<Ts...>>;
+        auto &value = std::get<I>(values);
+        auto &bytes = kept[I];
+        if constexpr (IS_TEXT_VALUE<Type>) {
+            if (reinterpret_cast<const Byte *>(value.data()) != bytes.data()) {
+                bytes.assign(value.begin(), value.end());
+                value = {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+            }
+        } else if constexpr (IS_RANGE_VALUE<Type>) {
+            if (value.data() != bytes.data()) {
+                const std::size_t size = value.size() * sizeof(std::ranges::range_value_t<Type>);
+                bytes.assign(value.data(), value.data() + size);
+                value = {bytes.data(), size};
+            }
+        }
+    }
+
+    Function function;
+    std::tuple<UnpackedType<Ts>...> values;
+    // viewed bytes of a block which isn't complete yet
+    std::array<std::vector<Byte>, sizeof...(Ts)> kept;
+    std::size_t index = 0;
+    std::size_t mismatched = 0;
+};
+
+// E.g. BasicReceiver receiver(unpack<int, const char *>([](int id, std::string_view name) {}));
+template<typename ...Ts, typename Function>
+Unpacker<Function, Ts...> unpack(Function function) {
+    return Unpacker<Function, Ts...>(std::move(function));
+}
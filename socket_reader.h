@@ -0,0 +1,144 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// Feeds receivers from non-blocking sockets (or pipes) registered with an edge-triggered epoll
+// instance, one epoll_wait covering all of them. Every read goes to the receiver's readBuffer, so the
+// bytes land once in memory and are parsed there. The descriptors aren't owned.
+template<typename ReceiverType = Receiver>
+struct EpollReader {
+    // Called when a descriptor reached end of file (error 0) or failed (errno), after which it is no
+    // longer polled.
+    using ClosedHandler = std::function<void(int fd, int error)>;
+
+    explicit EpollReader(ClosedHandler closed_ = {}, std::size_t readSize_ = 64 << 10)
+            : closed(std::move(closed_)),
+              readSize(readSize_),
+              epollFd(::epoll_create1(EPOLL_CLOEXEC)) {
+    }
+
+    ~EpollReader() {
+        if (epollFd >= 0) {
+            ::close(epollFd);
+        }
+    }
+
+    EpollReader(const EpollReader &reader) = delete;
+
+    EpollReader &operator=(const EpollReader &reader) = delete;
+
+    // Starts polling fd for receiver, which must outlive the registration. False on failure, errno
+    // tells why.
+    bool add(int fd, ReceiverType &receiver) {
+        auto connection = std::make_unique<Connection>(Connection{fd, &receiver, std::chrono::steady_clock::now()});
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = connection.get();
+        if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            return false;
+        }
+        connections[fd] = std::move(connection);
+        return true;
+    }
+
+    void remove(int fd) noexcept {
+        if (connections.erase(fd) > 0) {
+            ::epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+
+    // Waits up to timeoutMs (-1 forever) for readable descriptors and drains them. Returns how many
+    // were ready, -1 on failure with errno set.
+    int poll(int timeoutMs) {
+        constexpr int MAX_EVENTS = 64;
+        epoll_event events[MAX_EVENTS];
+        const int count = ::epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+        if (count < 0) {
+            return errno == EINTR ? 0 : -1;
+        }
+        for (int i = 0; i < count; ++i) {
+            drain(*static_cast<Connection *>(events[i].data.ptr), events[i].events);
+        }
+        return count;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return connections.size();
+    }
+
+    // Trims the reassembly buffers of the receivers which got nothing for idleFor, see
+    // BasicReceiver::trimBuffer().
+    void trimIdle(std::chrono::steady_clock::duration idleFor) {
+        const auto now = std::chrono::steady_clock::now();
+        for (auto &[fd, connection]: connections) {
+            if (now - connection->lastRead >= idleFor) {
+                connection->receiver->trimBuffer();
+            }
+        }
+    }
+
+private:
+    struct Connection {
+        int fd;
+        ReceiverType *receiver;
+        std::chrono::steady_clock::time_point lastRead;
+    };
+
+    void drain(Connection &connection, std::uint32_t events) {
+        // after a hang up the reads go on to the end of file, no other edge follows
+        const bool hungUp = (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+        connection.lastRead = std::chrono::steady_clock::now();
+        while (true) {
+            auto buffer = connection.receiver->readBuffer(readSize);
+            // the receiver's buffer pool is out of room, complete frames can still be parsed from here
+            const bool inPlace = !buffer.empty();
+            if (!inPlace) {
+                scratch.resize(readSize);
+                buffer = scratch;
+            }
+            const auto result = ::read(connection.fd, buffer.data(), buffer.size());
+            if (result > 0) {
+                if (inPlace) {
+                    connection.receiver->commitRead(result);
+                } else {
+                    connection.receiver->Receive(buffer.data(), result);
+                }
+                // a short read emptied the socket, the next bytes come with a new edge
+                if (!hungUp && static_cast<std::size_t>(result) < buffer.size()) {
+                    return;
+                }
+                continue;
+            }
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            const int error = result == 0 ? 0 : errno;
+            const int fd = connection.fd;
+            // connection is gone after this
+            remove(fd);
+            if (closed) {
+                closed(fd, error);
+            }
+            return;
+        }
+    }
+
+    ClosedHandler closed;
+    std::size_t readSize;
+    int epollFd;
+    std::vector<Byte> scratch;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "sender_receiver_bytes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+
+// Bounded lock-free queue of variable-size records between one producer and one consumer thread.
+// A record is stored contiguously: when it doesn't fit before the end of the storage, the tail of
+// the storage is skipped and the record starts at the front. Positions are 32-bit so that both
+// sides can block on them with std::atomic wait/notify without extra words.
+struct SpscRing {
+    // capacity is rounded up to a power of two, a larger one than 2^31 bytes gets 2^31
+    explicit SpscRing(std::size_t capacity_)
+            : capacity(roundCapacity(capacity_)),
+              storage(std::make_unique_for_overwrite<Byte[]>(capacity)) {
+    }
+
+    SpscRing(const SpscRing &ring) = delete;
+
+    SpscRing &operator=(const SpscRing &ring) = delete;
+
+    // the largest record tryReserve can ever succeed with
+    [[nodiscard]] std::size_t maxRecordSize() const noexcept {
+        return capacity / 2 - RECORD_HEADER_SIZE;
+    }
+
+    // Producer: returns room for a record of size bytes, or nullptr while the ring is too full.
+    // The record becomes visible to the consumer on commit().
+    Byte *tryReserve(std::size_t size) noexcept {
+        assert(size <= maxRecordSize());
+        const auto recordSize = alignRecord(RECORD_HEADER_SIZE + size);
+        const std::uint32_t offset = producer.tail & (capacity - 1);
+        const std::uint32_t contiguous = capacity - offset;
+        const std::uint32_t skipped = contiguous < recordSize ? contiguous : 0;
+        if (!hasRoom(skipped + recordSize)) {
+            return nullptr;
+        }
+        if (skipped > 0) {
+            writeHeader(offset, SKIP_MARKER);
+            producer.tail += skipped;
+        }
+        const std::uint32_t recordOffset = producer.tail & (capacity - 1);
+        writeHeader(recordOffset, static_cast<std::uint32_t>(size));
+        producer.reserved = producer.tail + recordSize;
+        return storage.get() + recordOffset + RECORD_HEADER_SIZE;
+    }
+
+    void commit() noexcept {
+        producer.tail = producer.reserved;
+        tail.store(producer.tail, std::memory_order_release);
+        // returns right away when the consumer isn't blocked
+        tail.notify_one();
+    }
+
+    // Producer: blocks while head is still at the observed position, i.e. until the consumer frees
+    // some room.
+    void waitForRoom() const noexcept {
+        head.wait(producer.head, std::memory_order_acquire);
+    }
+
+    // Consumer: the oldest committed record, empty when there is none. Stays valid until pop().
+    std::span<const Byte> front() noexcept {
+        if (consumer.head == consumer.tail) {
+            consumer.tail = tail.load(std::memory_order_acquire);
+            if (consumer.head == consumer.tail) {
+                return {};
+            }
+        }
+        std::uint32_t offset = consumer.head & (capacity - 1);
+        auto size = readHeader(offset);
+        if (size == SKIP_MARKER) {
+            consumer.head += capacity - offset;
+            offset = 0;
+            size = readHeader(offset);
+        }
+        consumer.size = size;
+        return {storage.get() + offset + RECORD_HEADER_SIZE, size};
+    }
+
+    void pop() noexcept {
+        consumer.head += alignRecord(RECORD_HEADER_SIZE + consumer.size);
+        head.store(consumer.head, std::memory_order_release);
+        head.notify_one();
+    }
+
+    // Consumer: blocks until a record is committed after the observed ones.
+    void waitForRecord() const noexcept {
+        tail.wait(consumer.tail, std::memory_order_acquire);
+    }
+
+    // Either side: bytes in use, including padding. Approximate while the other side is active.
+    [[nodiscard]] std::size_t usedBytes() const noexcept {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr std::uint32_t RECORD_HEADER_SIZE = sizeof(std::uint32_t);
+    static constexpr std::uint32_t RECORD_ALIGNMENT = 8;
+    // header of the skipped tail of the storage
+    static constexpr std::uint32_t SKIP_MARKER = ~std::uint32_t{0};
+
+    static std::uint32_t alignRecord(std::size_t size) noexcept {
+        return static_cast<std::uint32_t>((size + RECORD_ALIGNMENT - 1) & ~std::size_t{RECORD_ALIGNMENT - 1});
+    }
+
+    bool hasRoom(std::uint32_t size) noexcept {
+        if (producer.tail + size - producer.head <= capacity) {
+            return true;
+        }
+        producer.head = head.load(std::memory_order_acquire);
+        return producer.tail + size - producer.head <= capacity;
+    }
+
+    void writeHeader(std::uint32_t offset, std::uint32_t value) noexcept {
+        std::memcpy(storage.get() + offset, &value, sizeof(value));
+    }
+
+    [[nodiscard]] std::uint32_t readHeader(std::uint32_t offset) const noexcept {
+        std::uint32_t value;
+        std::memcpy(&value, storage.get() + offset, sizeof(value));
+        return value;
+    }
+
+    // clamped before rounding and narrowing in every build, a larger request would wrap to 0
+    static std::uint32_t roundCapacity(std::size_t requested) noexcept {
+        return static_cast<std::uint32_t>(std::bit_ceil(std::clamp<std::size_t>(requested, 64, MAX_CAPACITY)));
+    }
+
+    static constexpr std::size_t MAX_CAPACITY = std::size_t{1} << 31;
+
+    const std::uint32_t capacity;
+    const std::unique_ptr<Byte[]> storage;
+
+    // written by the consumer
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint32_t> head = 0;
+    // written by the producer
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint32_t> tail = 0;
+
+    // producer's own state with a cached copy of head
+    struct alignas(CACHE_LINE_SIZE) {
+        std::uint32_t tail = 0;
+        std::uint32_t reserved = 0;
+        std::uint32_t head = 0;
+    } producer;
+
+    // consumer's own state with a cached copy of tail
+    struct alignas(CACHE_LINE_SIZE) {
+        std::uint32_t head = 0;
+        std::uint32_t tail = 0;
+        std::uint32_t size = 0;
+    } consumer;
+};